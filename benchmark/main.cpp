@@ -0,0 +1,182 @@
+// Measures the throughput and the latency per call of the logger, for several sinks, logging styles and numbers of threads
+//   benchmark [<records> [<results file>]]
+// Each scenario runs in a child process (the sinks of the logger cannot be reset), and appends a CSV line to the results file
+// (benchmark.csv by default): sink, style, threads, records, seconds, records per second, p50, p99 and p99.9 latency (ns), lock waits,
+// and heap allocations per record (counted by the operator new of the benchmark, after a warm-up, until the producers finish).
+// The records of the cout sink go to the null device. A single scenario can be run with:
+//   benchmark --scenario <cout|file|json|rotating|async|sharded|mapped> <function|format|stream|disabled> <threads> <records> <results file>
+
+#include "logger.h"
+
+#include <cstdlib>
+
+namespace {
+  std::atomic<uint64_t> allocations{ 0 };
+}
+
+// The operators are not inlined, so that GCC does not pair their malloc and free with the new and delete expressions
+#if defined(__GNUC__) || defined(__clang__)
+ #define BENCHMARK_NOINLINE __attribute__((noinline))
+#else
+ #define BENCHMARK_NOINLINE
+#endif
+
+BENCHMARK_NOINLINE void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto memory{ std::malloc(size ? size : 1) }) return memory;
+  throw std::bad_alloc();
+}
+
+BENCHMARK_NOINLINE void operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+
+BENCHMARK_NOINLINE void operator delete(void* memory, std::size_t) noexcept {
+  std::free(memory);
+}
+
+namespace {
+  const size_t WARM_UP_RECORDS{ 1024 };
+  const size_t ASYNC_CAPACITY{ 1 << 16 };
+  const char* const SINKS[]{ "cout", "file", "json", "rotating", "async", "sharded", "mapped" };
+  const char* const STYLES[]{ "function", "format", "stream", "disabled" };
+  const int THREADS[]{ 1, 4, 16, 64 };
+  const char* const LOG_DIRECTORY{ "benchmark-logs" };
+
+  int64_t percentile(const std::vector<int64_t>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * static_cast<double>(sorted.size())))];
+  }
+
+  int runScenario(const std::string& sink, const std::string& style, int threads, size_t records, const std::string& results) {
+    using namespace utils;
+
+    std::filesystem::create_directories(LOG_DIRECTORY);
+    auto logFile{ (std::filesystem::path(LOG_DIRECTORY) / (sink + ".log")).string() };
+    Logger::setLevel(style == "disabled" ? LogLevel::INFO : LogLevel::DEBUG);
+    if (sink == "async") Logger::setAsync(ASYNC_CAPACITY);
+    // One shard per producer thread, up to one per core: more shards than cores only split the capacity of the rings
+    if (sink == "sharded")
+      Logger::setAsync(ASYNC_CAPACITY, Logger::Overflow::BLOCK, std::clamp<size_t>(std::thread::hardware_concurrency(), 1, static_cast<size_t>(threads)));
+    if (sink == "mapped") Logger::setMappedFiles(64 << 20);
+    if (sink == "rotating")
+      Logger::setLogFile(logFile, Logger::Policy::MAX_SIZE, 4, 16 << 20);
+    else if (sink == "json")
+      Logger::setLogFile(logFile, Logger::Policy::NONE, 0, 0, Logger::Format::JSON);
+    else if (sink != "cout")
+      Logger::setLogFile(logFile, Logger::Policy::NONE);
+
+    auto perThread{ std::max<size_t>(records / threads, 1) };
+    // The buffers of the slots of the async ring are allocated the first time they are used
+    auto warmUp{ sink == "async" || sink == "sharded" ? std::max(WARM_UP_RECORDS, 2 * ASYNC_CAPACITY / threads) : std::min(perThread, WARM_UP_RECORDS) };
+    std::vector<std::vector<int64_t>> latencies(threads);
+    std::atomic<int> ready{ 0 };
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t) {
+      producers.emplace_back([&, t]() {
+        auto& samples{ latencies[t] };
+        samples.reserve(perThread);
+        std::string text;
+        auto log{ [&](size_t i) {
+          if (style == "function") {
+            text.assign("benchmark record ").append(std::to_string(i));
+            logInfo(text);
+          }
+          else if (style == "format")
+            logInfoF("benchmark record {}", i);
+          else if (style == "stream")
+            infoOut << "benchmark record " << i;
+          else
+            logDebugF("benchmark record {}", i);
+        } };
+        // The thread-local buffers of the logger grow to their steady size
+        for (size_t i = 0; i < warmUp; ++i) log(i);
+        ++ready;
+        while (!go.load()) std::this_thread::yield();
+        for (size_t i = 0; i < perThread; ++i) {
+          auto start{ std::chrono::steady_clock::now() };
+          log(i);
+          samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+      });
+    }
+    while (ready.load() < threads) std::this_thread::yield();
+    // The records of the warm-up are written before the measure starts
+    Logger::flush();
+
+    auto start{ std::chrono::steady_clock::now() };
+    auto allocated{ allocations.load() };
+    go = true;
+    for (auto& producer : producers) producer.join();
+    allocated = allocations.load() - allocated;
+    // The pending records of the async writers are part of the cost
+    Logger::flush();
+    auto seconds{ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+
+    std::vector<int64_t> all;
+    all.reserve(perThread * threads);
+    for (auto& samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+    std::sort(all.begin(), all.end());
+
+    std::ofstream out(results, std::ios::app);
+    if (!out.is_open()) {
+      std::cerr << "Results file cannot be opened: " << results << std::endl;
+      return 1;
+    }
+    out << sink << ',' << style << ',' << threads << ',' << all.size() << ',' << seconds << ','
+      << static_cast<uint64_t>(static_cast<double>(all.size()) / seconds) << ',' << percentile(all, 0.5) << ',' << percentile(all, 0.99) << ','
+      << percentile(all, 0.999) << ',' << Logger::stats().lockWaits << ',' << static_cast<double>(allocated) / static_cast<double>(all.size()) << std::endl;
+    return 0;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc == 7 && std::string(argv[1]) == "--scenario")
+    return runScenario(argv[2], argv[3], std::atoi(argv[4]), std::strtoull(argv[5], nullptr, 10), argv[6]);
+
+  if (argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " [<records> [<results file>]]" << std::endl;
+    return 2;
+  }
+  std::string records{ argc > 1 ? argv[1] : "400000" };
+  std::string results{ argc > 2 ? argv[2] : "benchmark.csv" };
+  {
+    std::ofstream out(results, std::ios::trunc);
+    if (!out.is_open()) {
+      std::cerr << "Results file cannot be opened: " << results << std::endl;
+      return 1;
+    }
+    out << "sink,style,threads,records,seconds,records_per_second,p50_ns,p99_ns,p999_ns,lock_waits,allocations_per_record" << std::endl;
+  }
+
+#ifdef _WIN32
+  const std::string nullDevice{ "NUL" };
+#else
+  const std::string nullDevice{ "/dev/null" };
+#endif
+  int failures{ 0 };
+  for (auto sink : SINKS) {
+    for (auto style : STYLES) {
+      // The cost of a disabled level does not depend on the sink
+      if (std::string(style) == "disabled" && std::string(sink) != "file") continue;
+      for (auto threads : THREADS) {
+        std::filesystem::remove_all(LOG_DIRECTORY);
+        auto command{ "\"" + std::string(argv[0]) + "\" --scenario " + sink + " " + style + " " + std::to_string(threads) + " " + records +
+          " \"" + results + "\" > " + nullDevice };
+#ifdef _WIN32
+        // cmd.exe removes the first and the last quotes of the command
+        command = "\"" + command + "\"";
+#endif
+        std::cerr << sink << ' ' << style << ' ' << threads << " threads" << std::endl;
+        if (std::system(command.c_str()) != 0) {
+          std::cerr << "Scenario failed: " << command << std::endl;
+          ++failures;
+        }
+      }
+    }
+  }
+  std::filesystem::remove_all(LOG_DIRECTORY);
+  std::cerr << "Results written to " << results << std::endl;
+  return failures ? 1 : 0;
+}
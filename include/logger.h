@@ -5,7 +5,7 @@
 * Logger Utility
 *   4 levels of logging are defined: DEBUG, INFO, ERROR, NONE
 *   2 different logging methods can be used (they are convenient macros to the corresponding Logger methods):
-*     - functions, the parameter must be a string or a const char*:
+*     - functions, the parameter must be a string, a string_view or a const char*:
           logDebug
           logInfo 
           logError
@@ -13,6 +13,10 @@
           debugOut
           infoOut
           errorOut
+*     - Format strings, checked at compile time (each {} is replaced by the next argument):
+          logDebugF("user {} took {}us", id, duration)
+*     - Key/value fields:
+          logDebugKV("request done", "user", id, "latency_us", duration)
 
 *   By default all the log levels are enabled and are written to the standard output stream (cout)
 
@@ -22,12 +26,24 @@
 *     - Dynamically: call Logger::setLevel(Logger::<MIN_LEVEL_TO_BE_ENABLED>). Possible values are: Logger::DEBUG, Logger::INFO or Logger::ERROR 
 * 
 *   Each log level can be configured to be written in a different log file. Use:
-*     setLogFile(Level, logFile, policy, maxNumfiles, maxSize ) --> to set a logFile as output for a specific log level
-*     setLogFile(logFile, policy, maxNumfiles, maxSize )        --> to set a logFile as output for all log levels
-*   The policy indicates how the log files should be rotated. There are 3 possible policies:
+*     setLogFile(Level, logFile, policy, maxNumfiles, maxSize, format) --> to set a logFile as output for a specific log level
+*     setLogFile(logFile, policy, maxNumfiles, maxSize, format)        --> to set a logFile as output for all log levels
+*   A file already open in another level is shared with it (it keeps its policy).
+*   The policy indicates how the log files should be rotated. There are 4 possible policies:
 *     - None => The log files does not rotate
 *     - SizeRotation => The log file is rotated when a maximum size is reached (maxSize). The number of files is limited to MaxNumFiles
 *     - DailyRotation => The log file is daily rotated at midnight.
+*     - RecordsRotation => The log file is rotated when maxSize records have been written to it. The number of files is limited to MaxNumFiles
+*   The format is Format::TEXT (default), Format::BINARY (decoded with the logdecode tool) or Format::JSON.
+* 
+*   Other settings (see README.md):
+*     setFlushPolicy(level, policy, value), setDateTimeFormat(format), setSingleLine(enabled), setLayout<Layout<...>>()
+*     setAsync(capacity, overflow, shards), setBatching(maxRecords, maxBytes, maxDelay), flush()
+*     setMappedFiles(segmentSize), setIoUring(enable) (ENABLE_LOG_IO_URING), setCompression(codec, level) (ENABLE_LOG_COMPRESSION)
+*     addSink(level, sink), removeSinks(), rotate(), installCrashHandler()
+*     setRateLimit(level, recordsPerSecond, burst), setCallSiteRateLimit(recordsPerSecond, burst), setSampling(level, n)
+*     setFlightRecorder(records), dumpRecent(), stats(), dumpStats(), setStatsInterval(interval)
+*   Sinks must not call the configuration methods: they throw std::runtime_error when called while logging.
 * 
 *   A profiling log method is also provided. A timer will be started when calling:
 *     timerStart
@@ -36,6 +52,7 @@
 *   WATCH OUT: These timer methods will be disabled unless the macro ENABLE_PROFILING_LOG is added. It should not be used for the Release Build
 *   By default the timer log writes to std:cout. It can be changed to a file by using th esetLogFile() method        
 *   Several timers can be started in parallel, but they will be stopped in the reverse order, i.e., the last one to be started is stopped first.
+*   Named timers: timerScope("name"), Logger::dumpTimerStats(reset), Logger::setTimerStatsInterval(interval)
 */
 
 
@@ -50,46 +67,160 @@
 #include <cstdarg>
 #include <array>
 #include <vector>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <filesystem>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include <utility>
+#include <string_view>
+#include <charconv>
+#include <cmath>
+#include <type_traits>
+#include <cstring>
+#include <csignal>
+#include <exception>
 #include <time.h>
 
-#include <dual_function.h>
+#ifdef ENABLE_LOG_COMPRESSION
+ #if __has_include(<zlib.h>)
+  #define LOGGER_HAS_GZIP
+  #include <zlib.h>
+ #endif
+ #if __has_include(<zstd.h>)
+  #define LOGGER_HAS_ZSTD
+  #include <zstd.h>
+ #endif
+#endif
+
+#ifdef __linux__
+ #include <pthread.h>
+ #include <sched.h>
+ #if defined(ENABLE_LOG_IO_URING) && __has_include(<linux/io_uring.h>)
+  #define LOGGER_HAS_IO_URING
+  #include <linux/io_uring.h>
+  #include <sys/syscall.h>
+ #endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+ #define LOGGER_HAS_MMAP
+ #define LOGGER_HAS_WRITEV
+ #define LOGGER_HAS_SOCKETS
+ #define LOGGER_HAS_SIGACTION
+ #include <netdb.h>
+ #include <netinet/in.h>
+ #include <netinet/tcp.h>
+ #include <poll.h>
+ #include <signal.h>
+ #include <sys/socket.h>
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <sys/uio.h>
+ #include <unistd.h>
+ #include <climits>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define LOGGER_UNLIKELY(condition) __builtin_expect(static_cast<bool>(condition), 0)
+#else
+  #define LOGGER_UNLIKELY(condition) (condition)
+#endif
+
+// Vector scan of the text to escape: SSE2 on x86-64 (AVX2 if the CPU has it, with GCC and Clang), NEON on ARM64
+#if defined(__x86_64__) || defined(_M_X64)
+ #define LOGGER_HAS_SSE2
+ #include <emmintrin.h>
+ #if defined(__GNUC__) || defined(__clang__)
+  #define LOGGER_HAS_AVX2
+  #include <immintrin.h>
+ #else
+  #include <intrin.h>
+ #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+ #define LOGGER_HAS_NEON
+ #include <arm_neon.h>
+#endif
+
+// The level is checked before the arguments are evaluated (DEBUG is expected to be disabled in production)
+#define LOGGER_CHECK(enabled, ...) ((enabled) ? __VA_ARGS__ : void())
+#define LOGGER_DEBUG_ENABLED LOGGER_UNLIKELY(utils::Logger::isEnabled(utils::LogLevel::DEBUG))
+#define LOGGER_INFO_ENABLED utils::Logger::isEnabled(utils::LogLevel::INFO)
+#define LOGGER_ERROR_ENABLED utils::Logger::isEnabled(utils::LogLevel::ERROR)
+// Rate limits and sampling: a single relaxed load unless they are set. Each statement has its own call site, with a state per thread
+#define LOGGER_CALL_SITE(level) [] () -> utils::Logger::CallSiteState& { \
+    static utils::Logger::CallSite site(__FILE__, __LINE__, level); thread_local utils::Logger::CallSiteState state(site); return state; }
+#define LOGGER_ADMIT(level) utils::Logger::admit(level, LOGGER_CALL_SITE(level))
+#define LOGGER_DEBUG_ADMITTED (LOGGER_DEBUG_ENABLED && LOGGER_ADMIT(utils::LogLevel::DEBUG))
+#define LOGGER_INFO_ADMITTED (LOGGER_INFO_ENABLED && LOGGER_ADMIT(utils::LogLevel::INFO))
+#define LOGGER_ERROR_ADMITTED (LOGGER_ERROR_ENABLED && LOGGER_ADMIT(utils::LogLevel::ERROR))
+// The stream macros are guard expressions: the whole << chain is skipped (not evaluated) when the record is not admitted
+#define LOGGER_STREAM(admitted, stream) !(admitted) ? (void)0 : utils::Logger::StreamGuard{} & stream
+
+#define LOGGER_EXPAND(x) x
+#define LOGGER_FIRST_(first, ...) first
+#define LOGGER_FIRST(...) LOGGER_EXPAND(LOGGER_FIRST_(__VA_ARGS__, ~))
+// The format string literal is wrapped in a type, so that it can be checked at compile time
+#define LOGGER_FORMAT(format) [] { struct Format { static constexpr std::string_view text() { return format; } }; return Format{}; }()
+#define LOGGER_WRITE_FORMATTED(level, ...) utils::Logger::writeFormatted(level, LOGGER_FORMAT(LOGGER_FIRST(__VA_ARGS__)), __VA_ARGS__)
 
 
 #ifdef NO_DEBUG_LOG_BUILD
   #define logDebug(trace)
-  #define debugOut *utils::Logger::getNullStream()
+  #define logDebugF(...)
+  #define logDebugKV(...)
+  #define debugOut LOGGER_STREAM(false, utils::Logger::RecordStream{})
 #else
-  #define logDebug(trace) utils::Logger::debug(trace)
-  #define debugOut *utils::Logger::getDebugStream()
+  #define logDebug(trace) LOGGER_CHECK(LOGGER_DEBUG_ADMITTED, utils::Logger::debug(trace))
+  #define logDebugF(...) LOGGER_CHECK(LOGGER_DEBUG_ADMITTED, LOGGER_WRITE_FORMATTED(utils::LogLevel::DEBUG, __VA_ARGS__))
+  #define logDebugKV(...) LOGGER_CHECK(LOGGER_DEBUG_ADMITTED, utils::Logger::writeFields(utils::LogLevel::DEBUG, __VA_ARGS__))
+  #define debugOut LOGGER_STREAM(LOGGER_DEBUG_ADMITTED, utils::Logger::getDebugStream())
 #endif
 
 #ifdef NO_INFO_LOG_BUILD
  #define logInfo(trace)
- #define infoOut
+ #define logInfoF(...)
+ #define logInfoKV(...)
+ #define infoOut LOGGER_STREAM(false, utils::Logger::RecordStream{})
 #else
-  #define logInfo(trace) utils::Logger::info(trace)
-  #define infoOut *utils::Logger::getInfoStream()
+  #define logInfo(trace) LOGGER_CHECK(LOGGER_INFO_ADMITTED, utils::Logger::info(trace))
+  #define logInfoF(...) LOGGER_CHECK(LOGGER_INFO_ADMITTED, LOGGER_WRITE_FORMATTED(utils::LogLevel::INFO, __VA_ARGS__))
+  #define logInfoKV(...) LOGGER_CHECK(LOGGER_INFO_ADMITTED, utils::Logger::writeFields(utils::LogLevel::INFO, __VA_ARGS__))
+  #define infoOut LOGGER_STREAM(LOGGER_INFO_ADMITTED, utils::Logger::getInfoStream())
 #endif
 
 #ifdef NO_ERROR_LOG_BUILD
-  #define logError(trace) utils::Logger::error(trace)
-  #define errorOut *utils::Logger::getErrorStream()
+  #define logError(trace) LOGGER_CHECK(LOGGER_ERROR_ADMITTED, utils::Logger::error(trace))
+  #define logErrorF(...) LOGGER_CHECK(LOGGER_ERROR_ADMITTED, LOGGER_WRITE_FORMATTED(utils::LogLevel::ERROR, __VA_ARGS__))
+  #define logErrorKV(...) LOGGER_CHECK(LOGGER_ERROR_ADMITTED, utils::Logger::writeFields(utils::LogLevel::ERROR, __VA_ARGS__))
+  #define errorOut LOGGER_STREAM(LOGGER_ERROR_ADMITTED, utils::Logger::getErrorStream())
 #else
-  #define logError(trace) utils::Logger::error(trace)
-  #define errorOut *utils::Logger::getErrorStream()
+  #define logError(trace) LOGGER_CHECK(LOGGER_ERROR_ADMITTED, utils::Logger::error(trace))
+  #define logErrorF(...) LOGGER_CHECK(LOGGER_ERROR_ADMITTED, LOGGER_WRITE_FORMATTED(utils::LogLevel::ERROR, __VA_ARGS__))
+  #define logErrorKV(...) LOGGER_CHECK(LOGGER_ERROR_ADMITTED, utils::Logger::writeFields(utils::LogLevel::ERROR, __VA_ARGS__))
+  #define errorOut LOGGER_STREAM(LOGGER_ERROR_ADMITTED, utils::Logger::getErrorStream())
 #endif
 
 
+#define LOGGER_CONCAT_(a, b) a##b
+#define LOGGER_CONCAT(a, b) LOGGER_CONCAT_(a, b)
+
 #ifdef ENABLE_PROFILING_LOG
  #define timerStart       utils::Logger::startTimer(__FUNCTION__, __LINE__)
- #define timerStop(unit)  utils::Logger::stopTimer<std::chrono::##unit>(#unit, __FUNCTION__, __LINE__)
+ #define timerStop(unit)  utils::Logger::stopTimer<std::chrono::unit>(#unit, __FUNCTION__, __LINE__)
+ #define timerScope(name) utils::Logger::ScopedTimer LOGGER_CONCAT(_loggerScopedTimer, __LINE__){ name }
 #else
  #define timerStart
  #define timerStop(unit)
+ #define timerScope(name)
 #endif 
 
 
@@ -101,280 +232,4567 @@ namespace utils
   class Logger
   {
   public:
-    enum class Policy : uint8_t { NONE, MAX_SIZE, DAILY };
+    enum class Policy : uint8_t { NONE, MAX_SIZE, DAILY, MAX_RECORDS };
+    enum class Overflow : uint8_t { BLOCK, DROP_NEWEST, DROP_OLDEST };
+    enum class Flush : uint8_t { NEVER, RECORDS, INTERVAL, IMMEDIATE };
+    enum class Format : uint8_t { TEXT, BINARY, JSON };
+    enum class Compression : uint8_t { NONE, GZIP, ZSTD };
 
-  private:
+    // Formatted record given to the sinks: the text includes the header and the end of line
+    struct RecordView {
+      LogLevel level;
+      std::chrono::system_clock::time_point time;
+      std::string_view text;
+    };
 
-    class NullStream : public std::ostream {
-      inline static std::stringbuf _strbuf{};
+    // Logging statement, for the rate limit per call site, and its state in a thread (defined with the public API)
+    struct CallSite;
+    struct CallSiteState;
+
+    // Output of the records of some levels, in addition to their log file or stream (see addSink).
+    // The calls to a sink are serialized, and they must not throw. A record logged by a sink is given to the other sinks, not back to it
+    class Sink {
+      friend class Logger;
+      std::mutex _sm;
 
     public:
-      NullStream() : std::ostream{&_strbuf} {};
-      template <typename T>
-      NullStream& operator<<(T any) {
-        return *this;
+      virtual ~Sink() = default;
+
+      // Batch of records, in order
+      virtual void write(const RecordView* records, size_t count) = 0;
+
+      virtual void flush() {}
+
+      // Called by Logger::rotate()
+      virtual void rotate() {}
+    };
+
+    // Sink writing to a stream, e.g. std::cerr
+    class StreamSink : public Sink {
+      std::ostream& _stream;
+
+    public:
+      explicit StreamSink(std::ostream& stream) : _stream{ stream } {}
+
+      void write(const RecordView* records, size_t count) override {
+        for (size_t i = 0; i < count; ++i) _stream.write(records[i].text.data(), static_cast<std::streamsize>(records[i].text.size()));
+      }
+
+      void flush() override {
+        _stream.flush();
       }
     };
 
-    struct LogSink {
-      std::mutex lsm;
+#ifdef LOGGER_HAS_SOCKETS
+    // Sink shipping the records to a collector as syslog messages (RFC 5424): over UDP, or over a persistent TCP connection
+    // (octet counting framing, RFC 6587). The records are queued and sent by a background thread: a full queue drops them,
+    // so the application never waits for the network
+    class NetworkSink : public Sink {
+    public:
+      enum class Protocol : uint8_t { UDP, TCP };
 
-      std::ostream* stream{ nullptr };
-      std::string fileName{ "" };
-      std::string creationDate{ "" };
-      uintmax_t maxSize{ 0 };
-      uint8_t maxNumFiles{ 0 };
-      bool rotateDaily{ false };
+      struct Stats {
+        uint64_t sent;
+        uint64_t dropped;
+        uint64_t reconnections;
+      };
 
-      LogSink(std::ostream& strPtr) : stream{ &strPtr } {}
-      LogSink(const std::string& fileName, Policy policy, uint8_t maxNumFiles = 0, uintmax_t maxSize = 0)
-        : fileName{ fileName }, maxSize{ maxSize }, 
-        maxNumFiles{ policy == Policy::MAX_SIZE && maxSize ? std::max(maxNumFiles, static_cast<uint8_t>(2)) : static_cast<uint8_t>(0) } {
+    private:
+      inline static constexpr size_t BATCH{ 64 };
+      inline static constexpr size_t MAX_DATAGRAM{ 2048 };
+#ifdef MSG_NOSIGNAL
+      inline static constexpr int SEND_FLAGS{ MSG_NOSIGNAL };
+#else
+      inline static constexpr int SEND_FLAGS{ 0 };
+#endif
+#ifdef SOCK_CLOEXEC
+      inline static constexpr int SOCKET_FLAGS{ SOCK_CLOEXEC };
+#else
+      inline static constexpr int SOCKET_FLAGS{ 0 };
+#endif
 
-        if (policy == Policy::DAILY) {
-          std::time_t timestamp;
-          if (std::filesystem::exists(fileName)) {
-            auto lastWrite = std::filesystem::last_write_time(fileName);
-            auto timedif = decltype(lastWrite)::clock::now() - lastWrite;
-            timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() - timedif);
+      Protocol _protocol;
+      std::string _host;
+      std::string _port;
+      std::string _prefix;
+      int _socket{ -1 };
+      std::atomic<bool> _connected{ false };
+      // Queue of messages: the slots keep their buffers
+      std::vector<std::string> _queue;
+      size_t _head{ 0 };
+      size_t _size{ 0 };
+      std::mutex _qm;
+      std::condition_variable _cv;
+      bool _stop{ false };
+      std::atomic<uint64_t> _sent{ 0 };
+      std::atomic<uint64_t> _dropped{ 0 };
+      std::atomic<uint64_t> _reconnections{ 0 };
+      std::thread _thread;
+
+      void _disconnect() {
+        if (_socket >= 0) ::close(_socket);
+        _socket = -1;
+        _connected = false;
+      }
+
+      bool _connect() {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = _protocol == Protocol::TCP ? SOCK_STREAM : SOCK_DGRAM;
+        addrinfo* addresses;
+        if (getaddrinfo(_host.c_str(), _port.c_str(), &hints, &addresses) != 0) return false;
+        for (auto address = addresses; address && _socket < 0; address = address->ai_next) {
+          _socket = socket(address->ai_family, address->ai_socktype | SOCKET_FLAGS, address->ai_protocol);
+          if (_socket < 0) continue;
+          // Non-blocking connection, so that an unreachable collector does not hold the sender thread for minutes
+          auto flags{ fcntl(_socket, F_GETFL) };
+          fcntl(_socket, F_SETFL, flags | O_NONBLOCK);
+          auto result{ ::connect(_socket, address->ai_addr, address->ai_addrlen) };
+          if (result < 0 && errno == EINPROGRESS) {
+            pollfd descriptor{ _socket, POLLOUT, 0 };
+            int error{ 0 };
+            socklen_t length{ sizeof(error) };
+            if (poll(&descriptor, 1, 2000) == 1 && getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && !error) result = 0;
           }
-          else {
-            timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+          if (result < 0) {
+            _disconnect();
+            continue;
           }
-          std::stringstream strTM;
-          strTM << std::put_time(std::localtime(&timestamp), "%Y%m%d");
-          creationDate = strTM.str();
+          fcntl(_socket, F_SETFL, flags);
+          timeval timeout{ 1, 0 };
+          setsockopt(_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+          if (_protocol == Protocol::TCP) {
+            // The messages are coalesced by the sender thread instead
+            int noDelay{ 1 };
+            setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+          }
+        }
+        freeaddrinfo(addresses);
+        _connected = _socket >= 0;
+        return _connected;
+      }
+
+      // Returns the number of messages sent
+      size_t _send(std::vector<std::string>& batch, size_t count, std::string& stream) {
+        if (_protocol == Protocol::TCP) {
+          stream.clear();
+          for (size_t i = 0; i < count; ++i) stream.append(std::to_string(batch[i].size())).append(" ").append(batch[i]);
+          size_t done{ 0 };
+          while (done < stream.size()) {
+            auto sent{ ::send(_socket, stream.data() + done, stream.size() - done, SEND_FLAGS) };
+            if (sent < 0) {
+              if (errno == EINTR) continue;
+              return 0;
+            }
+            done += static_cast<size_t>(sent);
+          }
+          return count;
+        }
+
+#ifdef __linux__
+        std::array<iovec, BATCH> vectors;
+        std::array<mmsghdr, BATCH> messages{};
+        for (size_t i = 0; i < count; ++i) {
+          vectors[i] = iovec{ batch[i].data(), std::min(batch[i].size(), MAX_DATAGRAM) };
+          messages[i].msg_hdr.msg_iov = &vectors[i];
+          messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        size_t done{ 0 };
+        while (done < count) {
+          auto sent{ sendmmsg(_socket, messages.data() + done, static_cast<unsigned>(count - done), SEND_FLAGS) };
+          if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) continue;
+            break;
+          }
+          done += static_cast<size_t>(sent);
+        }
+        return done;
+#else
+        size_t done{ 0 };
+        for (; done < count; ++done) {
+          if (::send(_socket, batch[done].data(), std::min(batch[done].size(), MAX_DATAGRAM), SEND_FLAGS) < 0) break;
+        }
+        return done;
+#endif
+      }
 
-          stream = _openLogFile(fileName);
+      void _senderThread() {
+        std::vector<std::string> batch(BATCH);
+        std::string stream;
+        auto backoff{ std::chrono::milliseconds(100) };
+        auto nextAttempt{ std::chrono::steady_clock::now() };
+        std::unique_lock<std::mutex> lock(_qm);
+        while (true) {
+          if (_socket < 0) {
+            if (_stop) break;
+            // Reconnection with exponential backoff, the queue keeps filling up (and dropping) meanwhile
+            if (std::chrono::steady_clock::now() < nextAttempt) {
+              _cv.wait_until(lock, nextAttempt);
+              continue;
+            }
+            lock.unlock();
+            auto connected{ _connect() };
+            lock.lock();
+            if (!connected) {
+              nextAttempt = std::chrono::steady_clock::now() + backoff;
+              backoff = std::min(backoff * 2, std::chrono::milliseconds(30000));
+              continue;
+            }
+            backoff = std::chrono::milliseconds(100);
+          }
 
-          // Run thread to rotate file
-          std::thread rotThread(&Logger::_dailyRotationThread, std::ref(*this));
-          rotThread.detach();
+          _cv.wait(lock, [this]() { return _size || _stop; });
+          if (!_size) break;
+          size_t count{ 0 };
+          while (_size && count < BATCH) {
+            batch[count++].swap(_queue[_head]);
+            _head = (_head + 1) % _queue.size();
+            --_size;
+          }
+          _cv.notify_all();
+          lock.unlock();
+          auto sent{ _send(batch, count, stream) };
+          _sent.fetch_add(sent, std::memory_order_relaxed);
+          if (sent < count) {
+            _dropped.fetch_add(count - sent, std::memory_order_relaxed);
+            _disconnect();
+            _reconnections.fetch_add(1, std::memory_order_relaxed);
+            nextAttempt = std::chrono::steady_clock::now();
+          }
+          lock.lock();
         }
+        _disconnect();
+      }
 
-        stream = _openLogFile(fileName);
+      void _appendMessage(std::string& out, const RecordView& record) {
+        // <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG, with the facility user
+        static constexpr int SEVERITIES[]{ 7, 6, 3, 7 };
+        out.assign("<").append(std::to_string(8 + SEVERITIES[record.level])).append(">1 ");
+        auto time{ std::chrono::system_clock::to_time_t(record.time) };
+        auto micros{ std::chrono::duration_cast<std::chrono::microseconds>(record.time.time_since_epoch()).count() % 1000000 };
+        std::tm tm;
+        gmtime_r(&time, &tm);
+        char timestamp[40];
+        auto length{ std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm) };
+        std::snprintf(timestamp + length, sizeof(timestamp) - length, ".%06dZ ", static_cast<int>(micros));
+        out.append(timestamp).append(_prefix);
+        // Only the message of the text, without its header and end of line
+        auto text{ record.text };
+        auto header{ text.compare(0, 1, "{") ? text.find(_header(record.level)) : std::string_view::npos };
+        if (header != std::string_view::npos) text.remove_prefix(header + _header(record.level).size());
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) text.remove_suffix(1);
+        out.append(text);
       }
 
-      LogSink(const LogSink& ls) = delete;
-      LogSink(LogSink&& ls) = delete;
+    public:
+      NetworkSink(Protocol protocol, const std::string& host, uint16_t port, const std::string& appName = "logger", size_t queueCapacity = 8192)
+        : _protocol{ protocol }, _host{ host }, _port{ std::to_string(port) }, _queue(std::max<size_t>(queueCapacity, 1)) {
+        char hostName[256]{};
+        gethostname(hostName, sizeof(hostName) - 1);
+        _prefix.append(*hostName ? hostName : "-").append(" ").append(appName.empty() ? "-" : appName).append(" ").append(std::to_string(getpid())).append(" - - ");
+        _thread = std::thread(&NetworkSink::_senderThread, this);
+      }
 
-      ~LogSink() {
-        if (fileName != "") delete stream;
+      NetworkSink(const NetworkSink&) = delete;
+      NetworkSink& operator=(const NetworkSink&) = delete;
+
+      ~NetworkSink() override {
+        {
+          std::lock_guard<std::mutex> lock(_qm);
+          _stop = true;
+          _cv.notify_all();
+        }
+        _thread.join();
+      }
+
+      void write(const RecordView* records, size_t count) override {
+        std::lock_guard<std::mutex> lock(_qm);
+        for (size_t i = 0; i < count; ++i) {
+          if (_size == _queue.size()) {
+            _dropped.fetch_add(count - i, std::memory_order_relaxed);
+            break;
+          }
+          _appendMessage(_queue[(_head + _size) % _queue.size()], records[i]);
+          ++_size;
+        }
+        _cv.notify_all();
+      }
+
+      // Waits (1 second at most) for the queued messages to be sent while the collector is connected
+      void flush() override {
+        std::unique_lock<std::mutex> lock(_qm);
+        _cv.wait_for(lock, std::chrono::seconds(1), [this]() { return !_size || !_connected; });
+      }
+
+      Stats stats() const {
+        return Stats{ _sent.load(), _dropped.load(), _reconnections.load() };
       }
     };
-    
-    inline static const std::string _HEADERS[]{ "DEBUG: ", "INFO: ", "*** ERROR!\n                         " };
-    inline static std::string _dateTimeFormat{ "%F %T" };
+#endif
 
-    inline static NullStream _nullStream{};
+  private:
 
-    inline static std::vector<std::unique_ptr<std::chrono::time_point<std::chrono::high_resolution_clock>>> _timers;
-            
-    inline static std::shared_ptr<LogSink> defLogSink{ new LogSink(std::cout) };
-    inline static std::shared_ptr<LogSink> defErrLogSink{ new LogSink(std::cerr) };
-    inline static std::array<std::shared_ptr<LogSink>, 4> _sinks{ defLogSink, defLogSink, defErrLogSink, defLogSink };
-   
-    static void _dailyRotationThread(LogSink& sink);
+    // Stream buffer appending to a string (no allocation besides the growth of the string)
+    class StringBuf : public std::streambuf {
+      std::string& _text;
 
-    static void _sizeRotation(LogSink& sink);
-        
-    static void _write(LogLevel level, std::string trace);
+    protected:
+      int_type overflow(int_type ch) override {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) _text.push_back(traits_type::to_char_type(ch));
+        return ch;
+      }
+      std::streamsize xsputn(const char* s, std::streamsize count) override {
+        _text.append(s, static_cast<size_t>(count));
+        return count;
+      }
 
-    static void _writeOut(LogLevel level);
-       
-    inline static std::function<std::ostream* (LogLevel)> _getStream{ [](LogLevel level) {
-        Logger::_writeOut(level);
-        return _sinks[level]->stream;
+    public:
+      StringBuf(std::string& text) : _text{ text } {}
+    };
+
+    // Static description of a format string, one per call site of the logXxxF macros
+    struct FormatDescriptor {
+      std::string_view format;
+      // One type code per argument, see _packValue()
+      std::string_view signature;
+    };
+
+    // Fields of the records captured for the layout (see setLayout)
+    enum LayoutField : unsigned { LAYOUT_TIME = 1, LAYOUT_THREAD = 2, LAYOUT_SEQUENCE = 4, LAYOUT_LOCATION = 8 };
+
+    struct Record {
+      LogLevel level{ LogLevel::NONE };
+      // Deferred record: the data are the packed arguments of the format, rendered by the writer thread
+      const FormatDescriptor* format{ nullptr };
+      std::chrono::system_clock::time_point time;
+      // Formatted text, or packed arguments
+      std::string data;
+      // Only captured if the layout writes them, since the header of a deferred record is written by another thread
+      uint32_t thread{ 0 };
+      uint64_t sequence{ 0 };
+      const CallSite* site{ nullptr };
+
+      void reset(LogLevel recordLevel, const FormatDescriptor* recordFormat = nullptr) {
+        level = recordLevel;
+        format = recordFormat;
+        time = std::chrono::system_clock::now();
+        data.clear();
+        auto fields{ _layoutFields.load(std::memory_order_relaxed) };
+        thread = fields & LAYOUT_THREAD ? _threadId() : 0;
+        sequence = fields & LAYOUT_SEQUENCE ? _sequence.fetch_add(1, std::memory_order_relaxed) + 1 : 0;
+        site = fields & LAYOUT_LOCATION ? std::exchange(_callSite, nullptr) : nullptr;
+      }
+
+      void swap(Record& other) {
+        std::swap(level, other.level);
+        std::swap(format, other.format);
+        std::swap(time, other.time);
+        data.swap(other.data);
+        std::swap(thread, other.thread);
+        std::swap(sequence, other.sequence);
+        std::swap(site, other.site);
       }
     };
 
-    static std::ofstream* _openLogFile(const std::string& fileName);
+    // Record of a logging call: the thread-local one, or a local one when the call is made from within another logging call of the
+    // thread (by the formatting of an argument or by a sink), like the nested buffers of RecordStream
+    class CallRecord {
+      inline static thread_local unsigned _depth{ 0 };
+      std::optional<Record> _nested;
+      Record* _record;
 
-    Logger() = delete;
-            
-  public:
-    inline static void startTimer(const std::string& function, int line);
+    public:
+      CallRecord() {
+        thread_local Record record;
+        _record = _depth++ ? &_nested.emplace() : &record;
+      }
 
-    template <typename UNIT>
-    static void stopTimer(const std::string& unit, const std::string& function, int line);
+      ~CallRecord() {
+        --_depth;
+      }
 
-    static void setLevel(LogLevel level);
+      CallRecord(const CallRecord&) = delete;
+      CallRecord& operator=(const CallRecord&) = delete;
 
-    static void setLogFile(LogLevel level, const std::string& fileName, Policy policy, uint8_t maxNumFiles = 0, uintmax_t maxSize = 0);
-       
-    static void setLogFile(const std::string& fileName, Policy policy, uint8_t maxNumFiles = 0, uintmax_t maxSize = 0);       
+      Record& operator*() {
+        return *_record;
+      }
+    };
 
-    inline static DualFunction<void(std::string)> debug{ [](std::string trace) {_write(LogLevel::DEBUG, trace); }, [](std::string) {} };
-    inline static DualFunction<void(std::string)> info{ [](std::string trace) {_write(LogLevel::INFO, trace); }, [](std::string) {} };
-    inline static DualFunction<void(std::string)> error{ [](std::string trace) {_write(LogLevel::ERROR, trace); }, [](std::string) {} };
+    // Bounded lock-free multi-producer/multi-consumer ring of records (D. Vyukov's bounded queue).
+    // The records are swapped in and out of the slots, so their buffers keep circulating between the producers and the writer.
+    class RecordRing {
+      struct Slot {
+        std::atomic<size_t> seq{ 0 };
+        Record record;
+      };
 
-    inline static DualFunction<std::ostream* ()> getDebugStream{ []() { return _getStream(utils::LogLevel::DEBUG); }, []() { return &_nullStream; } };
-    inline static DualFunction<std::ostream* ()> getInfoStream{ []() { return _getStream(LogLevel::INFO); }, []() { return &_nullStream; } };
-    inline static DualFunction<std::ostream* ()> getErrorStream{ []() { return _getStream(LogLevel::ERROR); }, []() { return &_nullStream; } };
+      std::unique_ptr<Slot[]> _slots;
+      size_t _mask;
+      alignas(64) std::atomic<size_t> _enqueuePos{ 0 };
+      alignas(64) std::atomic<size_t> _dequeuePos{ 0 };
 
-  }; // END CLASS LOGGER
+    public:
+      RecordRing(size_t capacity) {
+        size_t size{ 2 };
+        while (size < capacity) size <<= 1;
+        _slots.reset(new Slot[size]);
+        _mask = size - 1;
+        for (size_t i = 0; i < size; ++i) _slots[i].seq.store(i, std::memory_order_relaxed);
+      }
 
+      bool tryPush(Record& record) {
+        Slot* slot;
+        size_t pos{ _enqueuePos.load(std::memory_order_relaxed) };
+        while (true) {
+          slot = &_slots[pos & _mask];
+          auto diff{ static_cast<intptr_t>(slot->seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos) };
+          if (diff == 0) {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+          }
+          else if (diff < 0)
+            return false;
+          else
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+        slot->record.swap(record);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
 
-  //  LOGGER: Private Methods 
-  //*************************************
-  void Logger::_dailyRotationThread(LogSink& sink) {
-    using namespace std::chrono_literals;
-    while (true) {
-      auto timestampNow = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-      std::stringstream strTMNow;
-      strTMNow << std::put_time(std::localtime(&timestampNow), "%Y%m%d");
-      // Rotate file
-      if (sink.creationDate != strTMNow.str() && std::filesystem::file_size(sink.fileName)) {
-        sink.lsm.lock();
-        sink.stream->flush();
-        static_cast<std::ofstream*>(sink.stream)->close();
-        std::filesystem::rename(sink.fileName, sink.fileName + "." + sink.creationDate);
-        sink.stream = _openLogFile(sink.fileName);
-        // Reset the creation date of the sink file
-        sink.creationDate = strTMNow.str();
-        sink.lsm.unlock();
+      bool tryPop(Record& record) {
+        Slot* slot;
+        size_t pos{ _dequeuePos.load(std::memory_order_relaxed) };
+        while (true) {
+          slot = &_slots[pos & _mask];
+          auto diff{ static_cast<intptr_t>(slot->seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos + 1) };
+          if (diff == 0) {
+            if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+          }
+          else if (diff < 0)
+            return false;
+          else
+            pos = _dequeuePos.load(std::memory_order_relaxed);
+        }
+        record.swap(slot->record);
+        slot->seq.store(pos + _mask + 1, std::memory_order_release);
+        return true;
       }
-      std::tm creationTime00;
-      std::stringstream strCreation00{ sink.creationDate };
-      strCreation00 >> std::get_time(&creationTime00, "%Y%m%d");
-      creationTime00.tm_hour = 0;
-      creationTime00.tm_min = 0;
-      creationTime00.tm_sec = 0;
-      auto creationTP00{ std::chrono::system_clock::from_time_t(std::mktime(&creationTime00)) };
-      auto sleep{ 24h - (std::chrono::system_clock::now() - creationTP00) };
-      std::this_thread::sleep_for(sleep);
-    }
-  }
+    };
 
-  void Logger::_write(LogLevel level, std::string trace) {
-    _sinks[level]->lsm.lock();
-    if (_sinks[level]->maxSize) _sizeRotation(*_sinks[level]);
-    auto timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() % 1000;
-    *_sinks[level]->stream << std::endl << std::put_time(std::localtime(&timestamp), _dateTimeFormat.c_str()) << "." << std::setw(3) << std::setfill('0') << milliseconds << " - " << _HEADERS[level] << trace;
-    _sinks[level]->lsm.unlock();
-  }
+    // Background writer of a log sink: the producers push into the ring of their shard and a single thread drains them to the stream
+    struct AsyncWriter {
+      // Ring of a group of producer threads, with its own counter, so that the shards do not share any cache line
+      struct Shard {
+        RecordRing ring;
+        alignas(64) std::atomic<uint64_t> pushed;
 
-  void Logger::_writeOut(LogLevel level) {
-    _sinks[level]->lsm.lock();
-    if (_sinks[level]->maxSize) _sizeRotation(*_sinks[level]);
-    auto timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() % 1000;
-    *_sinks[level]->stream << std::endl << std::put_time(std::localtime(&timestamp), _dateTimeFormat.c_str()) << "." << std::setw(3) << std::setfill('0') << milliseconds << " - " << _HEADERS[level];
-    _sinks[level]->lsm.unlock();
-  }
+        explicit Shard(size_t capacity) : ring{ capacity }, pushed{ 0 } {}
+      };
+
+      inline static constexpr unsigned BLOCK_SPINS{ 64 };
 
-  void Logger::_sizeRotation(LogSink& sink) {
-    if (std::filesystem::file_size(sink.fileName) > sink.maxSize) {
-      sink.stream->flush();
-      static_cast<std::ofstream*>(sink.stream)->close();
+      std::vector<std::unique_ptr<Shard>> shards;
+      // Records popped from each shard and not written yet: the writer merges the heads of the shards in timestamp order
+      std::vector<Record> heads;
+      std::vector<char> staged;
+      // Shards with a staged head, in a min-heap on the timestamps of the heads
+      std::vector<size_t> order;
+      Overflow overflow;
+      std::atomic<uint64_t> drained{ 0 };
+      std::atomic<uint64_t> dropped{ 0 };
+      std::atomic<bool> sleeping{ false };
+      // Producers waiting for space in a full ring (BLOCK overflow)
+      std::atomic<uint32_t> blocked{ 0 };
+      bool stop{ false };
+      std::mutex wm;
+      std::condition_variable wakeCv;
+      std::condition_variable drainedCv;
+      std::condition_variable spaceCv;
+      std::thread thread;
 
-      for (auto i = sink.maxNumFiles - 2; i > 0; --i) {
-        // If file exists, rename
-        std::string file = sink.fileName + "." + std::to_string(i);
-        if (std::filesystem::exists(file))
-          std::filesystem::rename(file, sink.fileName + "." + std::to_string(i + 1));
+      AsyncWriter(size_t capacity, Overflow overflow, size_t shardCount) : heads(shardCount), staged(shardCount, 0), overflow{ overflow } {
+        order.reserve(shardCount);
+        for (size_t i = 0; i < shardCount; ++i) shards.push_back(std::make_unique<Shard>(std::max<size_t>(capacity / shardCount, 2)));
       }
 
-      std::filesystem::rename(sink.fileName, sink.fileName + ".1");
+      // Drains the pending records. No logging call may be using it anymore
+      ~AsyncWriter() {
+        if (!thread.joinable()) return;
+        {
+          std::lock_guard<std::mutex> lock(wm);
+          stop = true;
+          wakeCv.notify_one();
+        }
+        thread.join();
+      }
 
-      sink.stream = _openLogFile(sink.fileName);
-      std::time_t timestamp{ std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) };
-      std::stringstream strTM;
-      strTM << std::put_time(std::localtime(&timestamp), "%Y%m%d");
-      sink.creationDate = strTM.str();
-    }
-  }
+      uint64_t pushed() const {
+        uint64_t total{ 0 };
+        for (auto& shard : shards) total += shard->pushed.load();
+        return total;
+      }
 
-  std::ofstream* Logger::_openLogFile(const std::string& fileName) {
-    std::ofstream* logFile = new std::ofstream(fileName, std::ios::ate | std::ios::app);
-    if (!logFile->is_open()) {
-      delete logFile;
-      throw std::runtime_error("Log File cannot be opened: " + fileName);
-    }
-    return logFile;
-  }
+      void push(Record& record) {
+        // The threads are assigned to the shards in turns
+        thread_local size_t index{ _nextShard.fetch_add(1, std::memory_order_relaxed) };
+        auto& shard{ *shards[shards.size() == 1 ? 0 : index % shards.size()] };
+        auto& ring{ shard.ring };
+        if (!ring.tryPush(record)) {
+          switch (overflow) {
+          case Overflow::BLOCK: {
+            // A short spin, then the producer waits for the writer to pop records
+            bool done{ false };
+            for (unsigned spin = 0; spin < BLOCK_SPINS && !done; ++spin) {
+              wake();
+              std::this_thread::yield();
+              done = ring.tryPush(record);
+            }
+            if (!done) waitSpace(ring, record);
+            break;
+          }
+          case Overflow::DROP_NEWEST: {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            auto& stats{ _stats() };
+            stats.add(stats.dropped[record.level], 1);
+            return;
+          }
+          case Overflow::DROP_OLDEST:
+            thread_local Record discarded;
+            do {
+              if (ring.tryPop(discarded)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                auto& stats{ _stats() };
+                stats.add(stats.dropped[discarded.level], 1);
+                drained.fetch_add(1);
+              }
+            } while (!ring.tryPush(record));
+          }
+        }
+        shard.pushed.fetch_add(1);
+        wake();
+      }
 
+      void wake() {
+        if (sleeping.load()) {
+          std::lock_guard<std::mutex> lock(wm);
+          wakeCv.notify_one();
+        }
+      }
 
-  // LOGGER: Public methods definitions
-  //*************************************
-  void Logger::startTimer(const std::string& function, int line) {
-    *_sinks[PROFILING]->stream << "\nTimer #" << _timers.size() + 1 << " STARTED at " << function << " (Line " << line << ")";
-    _timers.push_back(std::make_unique<std::chrono::time_point<std::chrono::high_resolution_clock>>(std::chrono::high_resolution_clock::now()));
-  }
+      void waitSpace(RecordRing& ring, Record& record) {
+        blocked.fetch_add(1);
+        // Pairs with the fence of the writer between its pops and its check of "blocked"
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::unique_lock<std::mutex> lock(wm);
+        while (!ring.tryPush(record)) {
+          if (sleeping.load()) wakeCv.notify_one();
+          spaceCv.wait(lock);
+        }
+        lock.unlock();
+        blocked.fetch_sub(1);
+      }
 
-  template <typename UNIT>
-  void Logger::stopTimer(const std::string& unit, const std::string& function, int line) {
-    auto stopTime{ std::chrono::high_resolution_clock::now() };
-    if (_timers.size()) {
-      auto duration{ std::chrono::duration_cast<UNIT>(stopTime - *_timers.back()).count() };
-      *_sinks[PROFILING]->stream << "\nTimer #" << _timers.size() << " STOPPED at " << function << " (Line " << line << ") --- DURATION = " << duration << " " << unit;
-      _timers.pop_back();
-    }
-    else
-      *_sinks[PROFILING]->stream << "Timer not started!" << std::endl;
-  }
+      // Wakes the producers waiting for space, once some records have been popped
+      void freed() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (blocked.load(std::memory_order_relaxed)) {
+          std::lock_guard<std::mutex> lock(wm);
+          spaceCv.notify_all();
+        }
+      }
 
-  void Logger::setLevel(LogLevel level) {
-    switch (level) {
-    case LogLevel::DEBUG:
-      debug.enableFirst();
-      info.enableFirst();
-      error.enableFirst();
-      getDebugStream.enableFirst();
-      getInfoStream.enableFirst();
-      getErrorStream.enableFirst();
-      break;
-    case LogLevel::INFO:
-      debug.enableSecond();
-      info.enableFirst();
-      error.enableFirst();
-      getDebugStream.enableSecond();
-      getInfoStream.enableFirst();
-      getErrorStream.enableFirst();
-      break;
-    case LogLevel::ERROR:
-      debug.enableSecond();
-      info.enableSecond();
-      error.enableFirst();
-      getDebugStream.enableSecond();
-      getInfoStream.enableSecond();
-      getErrorStream.enableFirst();
-      break;
-    case LogLevel::NONE:
-      debug.enableSecond();
-      info.enableSecond();
-      error.enableSecond();
-      getDebugStream.enableSecond();
-      getInfoStream.enableSecond();
-      getErrorStream.enableSecond();
-    }
-  }
+      void waitDrained() {
+        auto target{ pushed() };
+        std::unique_lock<std::mutex> lock(wm);
+        drainedCv.wait(lock, [&]() { return drained.load() >= target; });
+      }
+    };
 
-  void Logger::setLogFile(LogLevel level, const std::string& fileName, Policy policy, uint8_t maxNumFiles, uintmax_t maxSize) {
-    if (_sinks[level]->fileName != "")
-      throw std::runtime_error("Log file already assigned to this log level");
+#ifdef LOGGER_HAS_MMAP
+    // Log file written through preallocated memory mapped segments: the writers reserve their bytes with an atomic increment
+    // of the segment offset and copy them without any lock. Only moving to the next segment requires the lock of the sink
+    class MappedFile {
+    public:
+      struct Segment {
+        std::atomic<uint32_t> writers;
+        std::atomic<size_t> offset;
+        // Offset of the first reservation that did not fit
+        std::atomic<size_t> end;
+        char* data;
+        size_t capacity;
+        off_t base;
+        void* mapping;
+        size_t mappingSize;
+        uint64_t generation;
 
-    for (auto& sink : _sinks) {
-      if (sink->fileName == fileName) {
-        // Reuse sink
-        _sinks[level] = sink;
-        return;
+        Segment() : writers{ 0 }, offset{ 0 }, end{ SIZE_MAX }, data{ nullptr }, capacity{ 0 }, base{ 0 }, mapping{ nullptr }, mappingSize{ 0 }, generation{ 0 } {}
+      };
+
+    private:
+      std::array<Segment, 2> _segments;
+      std::atomic<Segment*> _current;
+      std::string _fileName;
+      size_t _segmentSize;
+      // The segment size is the limit of the file size (MAX_SIZE rotation) instead of the growth step
+      bool _limited;
+      int _fd{ -1 };
+      uint64_t _generation{ 0 };
+
+      void _map(Segment& segment, off_t base, size_t capacity) {
+        static const auto pageSize{ static_cast<off_t>(sysconf(_SC_PAGESIZE)) };
+        auto mapBase{ base - base % pageSize };
+        // Writers which entered the segment after it was sealed may still be failing their reservations
+        while (segment.writers.load()) std::this_thread::yield();
+        segment.generation = ++_generation;
+        segment.offset.store(0);
+        segment.end.store(SIZE_MAX);
+        segment.base = base;
+        segment.capacity = capacity;
+        segment.data = nullptr;
+        segment.mapping = nullptr;
+        segment.mappingSize = 0;
+        if (capacity) {
+#ifdef __linux__
+          if (fallocate(_fd, 0, base, static_cast<off_t>(capacity)) != 0)
+#endif
+            if (ftruncate(_fd, base + static_cast<off_t>(capacity)) != 0)
+              throw std::runtime_error("Log File cannot be allocated: " + _fileName);
+          segment.mappingSize = static_cast<size_t>(base - mapBase) + capacity;
+          segment.mapping = mmap(nullptr, segment.mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, mapBase);
+          if (segment.mapping == MAP_FAILED) {
+            segment.mapping = nullptr;
+            throw std::runtime_error("Log File cannot be mapped: " + _fileName);
+          }
+          segment.data = static_cast<char*>(segment.mapping) + (base - mapBase);
+        }
+        _current.store(&segment);
       }
-    }
 
-    // File not used in any other level
-    _sinks[level] = std::shared_ptr<LogSink>(new LogSink(fileName, policy, maxNumFiles, maxSize));
-  }
+      // Makes the next reservations fail, waits for the writers in progress and returns the bytes used
+      static size_t _seal(Segment& segment) {
+        auto sealed{ segment.offset.fetch_add(segment.capacity + 1) };
+        while (segment.writers.load()) std::this_thread::yield();
+        return std::min(sealed, segment.end.load());
+      }
 
-  void Logger::setLogFile(const std::string& fileName, Policy policy, uint8_t maxNumFiles, uintmax_t maxSize) {
-    for (auto& sink : _sinks) {
-      if (sink->fileName != "")
-        throw std::runtime_error("Log file already assigned to a log sink: " + sink->fileName);
-    }
+      static void _unmap(Segment& segment) {
+        if (segment.mapping) munmap(segment.mapping, segment.mappingSize);
+        segment.mapping = nullptr;
+        segment.data = nullptr;
+      }
+
+      Segment& _next() {
+        return _current.load() == &_segments[0] ? _segments[1] : _segments[0];
+      }
+
+    public:
+      MappedFile(const std::string& fileName, size_t segmentSize, bool limited)
+        : _current{ &_segments[0] }, _fileName{ fileName }, _segmentSize{ segmentSize }, _limited{ limited } {}
+
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      ~MappedFile() {
+        close();
+      }
+
+      // Lock free: returns the generation of the segment found full, or 0 once the data is written
+      uint64_t append(std::string_view data) {
+        Segment* segment;
+        while (true) {
+          segment = _current.load();
+          segment->writers.fetch_add(1);
+          if (_current.load() == segment) break;
+          segment->writers.fetch_sub(1);
+        }
+        auto start{ segment->offset.fetch_add(data.size(), std::memory_order_relaxed) };
+        bool fits{ start + data.size() <= segment->capacity };
+        if (fits)
+          std::memcpy(segment->data + start, data.data(), data.size());
+        else {
+          auto end{ segment->end.load() };
+          while (start < end && !segment->end.compare_exchange_weak(end, start));
+        }
+        auto generation{ fits ? 0 : segment->generation };
+        segment->writers.fetch_sub(1);
+        return generation;
+      }
+
+      // Generation of the current segment, to be called with the lock of the sink
+      uint64_t generation() const {
+        return _current.load()->generation;
+      }
+
+      // Opens the file and maps a segment at its end
+      void open(size_t minCapacity = 0) {
+        _fd = ::open(_fileName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (_fd < 0) throw std::runtime_error("Log File cannot be opened: " + _fileName);
+        struct stat status;
+        fstat(_fd, &status);
+        auto size{ static_cast<size_t>(status.st_size) };
+        auto capacity{ _limited ? (_segmentSize > size ? _segmentSize - size : 0) : _segmentSize };
+        // The writer of a record larger than the segment needs it to fit in a new file
+        if (!size) capacity = std::max(capacity, minCapacity);
+        _map(_next(), status.st_size, capacity);
+      }
+
+      // Maps the next segment of the file, right after the data of the current one
+      void extend(size_t minCapacity) {
+        auto& segment{ *_current.load() };
+        auto used{ _seal(segment) };
+        _map(_next(), segment.base + static_cast<off_t>(used), std::max(_segmentSize, minCapacity));
+        _unmap(segment);
+      }
+
+      // Truncates the file to the data written. The writers fail until it is opened again
+      void close() {
+        if (_fd < 0) return;
+        auto& segment{ *_current.load() };
+        auto used{ _seal(segment) };
+        _unmap(segment);
+        ftruncate(_fd, segment.base + static_cast<off_t>(used));
+        ::close(_fd);
+        _fd = -1;
+      }
+    };
+#else
+    // Memory mapped files are not available in this platform: the log files are always written through streams
+    class MappedFile {
+    public:
+      MappedFile(const std::string&, size_t, bool) {}
+      uint64_t append(std::string_view) { return 0; }
+      uint64_t generation() const { return 0; }
+      void open(size_t = 0) {}
+      void extend(size_t) {}
+      void close() {}
+    };
+#endif
+
+    // Stream of a log file, which can also write a batch of records at once: with a single writev call where available
+    class LogFile : public std::ostream {
+#ifdef LOGGER_HAS_WRITEV
+      class FileBuf : public std::streambuf {
+        int _fd{ -1 };
+        std::vector<char> _buffer;
+        // Kept between the batches, so that writing a batch allocates nothing
+        std::vector<iovec> _pieces;
+
+        bool _writeAll(const char* data, size_t size) {
+          while (size) {
+            auto written{ ::write(_fd, data, size) };
+            if (written < 0) {
+              if (errno == EINTR) continue;
+              return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+          }
+          return true;
+        }
+
+        bool _flushBuffer() {
+          auto ok{ _writeAll(pbase(), static_cast<size_t>(pptr() - pbase())) };
+          setp(_buffer.data(), _buffer.data() + _buffer.size());
+          return ok;
+        }
+
+      protected:
+        int_type overflow(int_type c) override {
+          if (!_flushBuffer()) return traits_type::eof();
+          if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+          }
+          return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char* data, std::streamsize size) override {
+          if (size > epptr() - pptr()) {
+            if (!_flushBuffer()) return 0;
+            if (size >= static_cast<std::streamsize>(_buffer.size())) return _writeAll(data, static_cast<size_t>(size)) ? size : 0;
+          }
+          std::memcpy(pptr(), data, static_cast<size_t>(size));
+          pbump(static_cast<int>(size));
+          return size;
+        }
+
+        int sync() override {
+          return _flushBuffer() ? 0 : -1;
+        }
+
+      public:
+        FileBuf() : _buffer(1 << 16) {}
+
+        ~FileBuf() override {
+          close();
+        }
+
+        bool open(const std::string& fileName, bool) {
+          _fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+          setp(_buffer.data(), _buffer.data() + _buffer.size());
+          return _fd >= 0;
+        }
+
+        void close() {
+          if (_fd < 0) return;
+          _flushBuffer();
+          ::close(_fd);
+          _fd = -1;
+        }
+
+        bool writeBatch(const std::vector<std::string_view>& pieces) {
+          if (!_flushBuffer()) return false;
+          auto& vector{ _pieces };
+          for (size_t first = 0; first < pieces.size(); first += IOV_MAX) {
+            vector.clear();
+            for (size_t i = first; i < pieces.size() && i < first + IOV_MAX; ++i)
+              vector.push_back(iovec{ const_cast<char*>(pieces[i].data()), pieces[i].size() });
+            auto* next{ vector.data() };
+            auto count{ static_cast<int>(vector.size()) };
+            while (count) {
+              auto written{ ::writev(_fd, next, count) };
+              if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+              }
+              // Partial write: skips the pieces written and resumes in the middle of the current one
+              while (count && static_cast<size_t>(written) >= next->iov_len) {
+                written -= static_cast<ssize_t>(next->iov_len);
+                ++next;
+                --count;
+              }
+              if (count) {
+                next->iov_base = static_cast<char*>(next->iov_base) + written;
+                next->iov_len -= static_cast<size_t>(written);
+              }
+            }
+          }
+          return true;
+        }
+
+        // For the crash handler: only write(2) calls and the pointers of the buffer, no lock and no allocation
+        void emergencyWrite(std::string_view data) {
+          _flushBuffer();
+          _writeAll(data.data(), data.size());
+        }
+      };
+#else
+      class FileBuf : public std::filebuf {
+      public:
+        bool open(const std::string& fileName, bool binary) {
+          return std::filebuf::open(fileName, std::ios::out | std::ios::app | (binary ? std::ios::binary : std::ios::openmode{}));
+        }
+
+        void close() {
+          std::filebuf::close();
+        }
+
+        bool writeBatch(const std::vector<std::string_view>& pieces) {
+          for (auto& piece : pieces) {
+            if (sputn(piece.data(), static_cast<std::streamsize>(piece.size())) != static_cast<std::streamsize>(piece.size())) return false;
+          }
+          return true;
+        }
+
+        // Best effort: there is no async-signal-safe way to write the file through the stream
+        void emergencyWrite(std::string_view data) {
+          sputn(data.data(), static_cast<std::streamsize>(data.size()));
+          pubsync();
+        }
+      };
+#endif
+      FileBuf _buffer;
+
+#ifdef LOGGER_HAS_IO_URING
+      // io_uring through its system calls: the submission and completion rings are mapped from the kernel. It has a single
+      // submitter, which also reaps the completions
+      class Ring {
+        int _fd{ -1 };
+        void* _sqRing{ MAP_FAILED };
+        size_t _sqRingSize{ 0 };
+        void* _cqRing{ MAP_FAILED };
+        size_t _cqRingSize{ 0 };
+        io_uring_sqe* _sqes{ static_cast<io_uring_sqe*>(MAP_FAILED) };
+        size_t _sqesSize{ 0 };
+        unsigned* _sqHead{ nullptr };
+        unsigned* _sqTail{ nullptr };
+        unsigned* _sqArray{ nullptr };
+        unsigned _sqMask{ 0 };
+        unsigned _sqEntries{ 0 };
+        unsigned* _cqHead{ nullptr };
+        unsigned* _cqTail{ nullptr };
+        io_uring_cqe* _cqes{ nullptr };
+        unsigned _cqMask{ 0 };
+        // Tail of the entries prepared, published to the kernel by submit()
+        unsigned _tail{ 0 };
+
+        static void* _map(int fd, size_t size, off_t offset) {
+          return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        }
+
+        int _enter(unsigned submit, unsigned wait) {
+          int result;
+          do {
+            result = static_cast<int>(syscall(__NR_io_uring_enter, _fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+          } while (result < 0 && errno == EINTR);
+          return result;
+        }
+
+      public:
+        Ring() = default;
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+
+        ~Ring() {
+          if (_sqes != MAP_FAILED) munmap(_sqes, _sqesSize);
+          if (_cqRing != MAP_FAILED && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+          if (_sqRing != MAP_FAILED) munmap(_sqRing, _sqRingSize);
+          if (_fd >= 0) ::close(_fd);
+        }
 
-    auto tmp{ std::shared_ptr<LogSink>(new LogSink(fileName, policy, maxNumFiles, maxSize)) };
-    for (auto& sink : _sinks) sink = tmp;
+        // Returns false if the kernel does not allow io_uring
+        bool init(unsigned entries) {
+          io_uring_params params{};
+          _fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+          if (_fd < 0) return false;
+          _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+          _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+          // Both rings in a single mapping since Linux 5.4
+          if (params.features & IORING_FEAT_SINGLE_MMAP) _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+          _sqRing = _map(_fd, _sqRingSize, IORING_OFF_SQ_RING);
+          if (_sqRing == MAP_FAILED) return false;
+          _cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? _sqRing : _map(_fd, _cqRingSize, IORING_OFF_CQ_RING);
+          if (_cqRing == MAP_FAILED) return false;
+          _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+          _sqes = static_cast<io_uring_sqe*>(_map(_fd, _sqesSize, IORING_OFF_SQES));
+          if (_sqes == MAP_FAILED) return false;
+          auto sq{ static_cast<char*>(_sqRing) };
+          _sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+          _sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+          _sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+          _sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+          _sqEntries = params.sq_entries;
+          auto cq{ static_cast<char*>(_cqRing) };
+          _cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+          _cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+          _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+          _cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+          _tail = *_sqTail;
+          return true;
+        }
+
+        bool registerBuffers(const iovec* buffers, unsigned count) {
+          return syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+        }
+
+        // Next free submission entry, cleared, or nullptr if the queue is full
+        io_uring_sqe* sqe() {
+          if (_tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries) return nullptr;
+          auto index{ _tail & _sqMask };
+          auto sqe{ &_sqes[index] };
+          std::memset(sqe, 0, sizeof(io_uring_sqe));
+          _sqArray[index] = index;
+          ++_tail;
+          return sqe;
+        }
+
+        // Publishes the prepared entries and makes the kernel consume them
+        void submit() {
+          __atomic_store_n(_sqTail, _tail, __ATOMIC_RELEASE);
+          auto pending{ _tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) };
+          if (pending) _enter(pending, 0);
+        }
+
+        // Oldest completion not seen yet, or nullptr
+        io_uring_cqe* peek() {
+          auto head{ *_cqHead };
+          if (head == __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) return nullptr;
+          return &_cqes[head & _cqMask];
+        }
+
+        // Waits for a completion (submitting the entries the kernel has not consumed yet), or returns nullptr if the ring failed
+        io_uring_cqe* wait() {
+          while (true) {
+            if (auto cqe{ peek() }) return cqe;
+            if (_enter(_tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE), 1) < 0) return nullptr;
+          }
+        }
+
+        // Releases the completion returned by peek() or wait()
+        void seen() {
+          __atomic_store_n(_cqHead, *_cqHead + 1, __ATOMIC_RELEASE);
+        }
+      };
+
+      // Writes through io_uring from a pool of registered buffers: a full buffer is submitted and the stream goes on in the next one.
+      // The writes have explicit offsets, so they can complete in any order
+      class UringBuf : public std::streambuf {
+        inline static constexpr unsigned BUFFERS{ 8 };
+        inline static constexpr size_t BUFFER_SIZE{ 1 << 18 };
+        // User data of the fsync requests
+        inline static constexpr uintptr_t FSYNC{ BUFFERS };
+
+        struct Write {
+          bool busy;
+          size_t size;
+          off_t offset;
+        };
+
+        Ring _ring;
+        int _fd{ -1 };
+        std::vector<char> _memory;
+        std::array<Write, BUFFERS> _writes{};
+        unsigned _current{ 0 };
+        unsigned _pending{ 0 };
+        off_t _offset{ 0 };
+        bool _failed{ false };
+
+        char* _data(unsigned index) {
+          return _memory.data() + index * BUFFER_SIZE;
+        }
+
+        void _submitWrite(unsigned index) {
+          auto& write{ _writes[index] };
+          // The queue has twice the entries that can be in flight (a write per buffer and an fsync): only full if the ring failed
+          auto sqe{ _ring.sqe() };
+          if (!sqe) {
+            _failed = true;
+            write.busy = false;
+            --_pending;
+            return;
+          }
+          sqe->opcode = IORING_OP_WRITE_FIXED;
+          sqe->fd = _fd;
+          sqe->addr = reinterpret_cast<uintptr_t>(_data(index));
+          sqe->len = static_cast<uint32_t>(write.size);
+          sqe->off = static_cast<uint64_t>(write.offset);
+          sqe->buf_index = static_cast<uint16_t>(index);
+          sqe->user_data = index;
+          _ring.submit();
+        }
+
+        void _complete(io_uring_cqe* cqe) {
+          auto index{ static_cast<uintptr_t>(cqe->user_data) };
+          auto result{ cqe->res };
+          _ring.seen();
+          --_pending;
+          if (index == FSYNC) {
+            if (result < 0) _failed = true;
+            return;
+          }
+          auto& write{ _writes[index] };
+          if (result == -EINTR || result == -EAGAIN || (result > 0 && static_cast<size_t>(result) < write.size)) {
+            // Short write: the rest of the buffer is written at the next offset
+            auto done{ result > 0 ? static_cast<size_t>(result) : 0 };
+            write.offset += static_cast<off_t>(done);
+            write.size -= done;
+            std::memmove(_data(static_cast<unsigned>(index)), _data(static_cast<unsigned>(index)) + done, write.size);
+            ++_pending;
+            _submitWrite(static_cast<unsigned>(index));
+            return;
+          }
+          if (result <= 0) _failed = true;
+          write.busy = false;
+        }
+
+        // Handles the completions, waiting for one if requested
+        void _reap(bool wait) {
+          io_uring_cqe* cqe;
+          if (wait && _pending) {
+            if (!(cqe = _ring.wait())) {
+              // The ring failed: the writes in flight are lost
+              _failed = true;
+              _pending = 0;
+              for (auto& write : _writes) write.busy = false;
+              return;
+            }
+            _complete(cqe);
+          }
+          while (_pending && (cqe = _ring.peek())) _complete(cqe);
+        }
+
+        bool _flushBuffer() {
+          auto size{ static_cast<size_t>(pptr() - pbase()) };
+          if (size) {
+            _writes[_current] = Write{ true, size, _offset };
+            _offset += static_cast<off_t>(size);
+            ++_pending;
+            _submitWrite(_current);
+            // Only blocks if all the buffers are in flight
+            _reap(false);
+            while (_writes[_current].busy) {
+              _current = (_current + 1) % BUFFERS;
+              if (_writes[_current].busy) _reap(true);
+            }
+            setp(_data(_current), _data(_current) + BUFFER_SIZE);
+          }
+          return !_failed;
+        }
+
+      protected:
+        int_type overflow(int_type c) override {
+          if (!_flushBuffer()) return traits_type::eof();
+          if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+          }
+          return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char* data, std::streamsize size) override {
+          auto left{ size };
+          while (left) {
+            if (epptr() == pptr() && !_flushBuffer()) return size - left;
+            auto chunk{ std::min<std::streamsize>(left, epptr() - pptr()) };
+            std::memcpy(pptr(), data, static_cast<size_t>(chunk));
+            pbump(static_cast<int>(chunk));
+            data += chunk;
+            left -= chunk;
+          }
+          return size;
+        }
+
+        int sync() override {
+          return _flushBuffer() ? 0 : -1;
+        }
+
+      public:
+        ~UringBuf() override {
+          close();
+        }
+
+        // Returns false if io_uring is not usable (e.g. old kernel or not allowed), to fall back to the regular file
+        bool open(const std::string& fileName) {
+          if (!_ring.init(2 * (BUFFERS + 1))) return false;
+          _memory.resize(BUFFERS * BUFFER_SIZE);
+          std::array<iovec, BUFFERS> buffers;
+          for (unsigned i = 0; i < BUFFERS; ++i) buffers[i] = iovec{ _data(i), BUFFER_SIZE };
+          if (!_ring.registerBuffers(buffers.data(), BUFFERS)) return false;
+          _fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+          if (_fd < 0) return false;
+          struct stat status;
+          fstat(_fd, &status);
+          _offset = status.st_size;
+          setp(_data(_current), _data(_current) + BUFFER_SIZE);
+          return true;
+        }
+
+        // Waits for the writes in flight and syncs the file to disk
+        bool fsync() {
+          _flushBuffer();
+          while (_pending) _reap(true);
+          auto sqe{ _ring.sqe() };
+          if (!sqe) return false;
+          sqe->opcode = IORING_OP_FSYNC;
+          sqe->fd = _fd;
+          sqe->user_data = FSYNC;
+          ++_pending;
+          _ring.submit();
+          while (_pending) _reap(true);
+          return !_failed;
+        }
+
+        void close() {
+          if (_fd >= 0) {
+            _flushBuffer();
+            while (_pending) _reap(true);
+            ::close(_fd);
+            _fd = -1;
+          }
+        }
+
+        bool writeBatch(const std::vector<std::string_view>& pieces) {
+          for (auto& piece : pieces) xsputn(piece.data(), static_cast<std::streamsize>(piece.size()));
+          return _flushBuffer();
+        }
+
+        // For the crash handler: the current buffer and the data are written with pwrite(2) after the writes in flight, without the ring
+        void emergencyWrite(std::string_view data) {
+          auto pwriteAll{ [this](const char* bytes, size_t size) {
+            while (size) {
+              auto written{ ::pwrite(_fd, bytes, size, _offset) };
+              if (written < 0) {
+                if (errno == EINTR) continue;
+                return;
+              }
+              bytes += written;
+              size -= static_cast<size_t>(written);
+              _offset += static_cast<off_t>(written);
+            }
+          } };
+          pwriteAll(pbase(), static_cast<size_t>(pptr() - pbase()));
+          setp(pbase(), epptr());
+          pwriteAll(data.data(), data.size());
+        }
+      };
+
+      std::unique_ptr<UringBuf> _uring;
+#endif
+
+    public:
+      LogFile(const std::string& fileName, bool binary) : std::ostream{ nullptr } {
+#ifdef LOGGER_HAS_IO_URING
+        if (_ioUring) {
+          auto uring{ std::make_unique<UringBuf>() };
+          if (uring->open(fileName)) {
+            _uring = std::move(uring);
+            rdbuf(_uring.get());
+            return;
+          }
+        }
+#endif
+        if (_buffer.open(fileName, binary))
+          rdbuf(&_buffer);
+        else
+          setstate(std::ios::badbit);
+      }
+
+      bool is_open() const {
+        return rdbuf() != nullptr;
+      }
+
+#ifdef LOGGER_HAS_IO_URING
+      // Whether the kernel allows io_uring, probed once
+      static bool ioUringAvailable() {
+        static const bool available{ []() { Ring ring; return ring.init(1); }() };
+        return available;
+      }
+#endif
+
+      void close() {
+#ifdef LOGGER_HAS_IO_URING
+        if (_uring) {
+          _uring->close();
+          return;
+        }
+#endif
+        _buffer.close();
+      }
+
+      void writeBatch(const std::vector<std::string_view>& pieces) {
+#ifdef LOGGER_HAS_IO_URING
+        if (_uring) {
+          if (!_uring->writeBatch(pieces)) setstate(std::ios::badbit);
+          return;
+        }
+#endif
+        if (!_buffer.writeBatch(pieces)) setstate(std::ios::badbit);
+      }
+
+      // Async-signal-safe on POSIX systems, for the crash handler: writes the buffered bytes and then the data straight to the file
+      void emergencyWrite(std::string_view data) {
+#ifdef LOGGER_HAS_IO_URING
+        if (_uring) {
+          _uring->emergencyWrite(data);
+          return;
+        }
+#endif
+        _buffer.emergencyWrite(data);
+      }
+
+      // Syncs the file to disk if it is written through io_uring
+      void fsync() {
+#ifdef LOGGER_HAS_IO_URING
+        if (_uring && !_uring->fsync()) setstate(std::ios::badbit);
+#endif
+      }
+    };
+
+    struct LogSink {
+      std::mutex lsm;
+
+      std::ostream* stream{ nullptr };
+      std::string fileName{ "" };
+      std::string creationDate{ "" };
+      uintmax_t maxSize{ 0 };
+      uintmax_t maxRecords{ 0 };
+      uint8_t maxNumFiles{ 0 };
+      // Time of the next daily rotation (0 if the file does not rotate daily), checked by the writers before each record
+      std::atomic<std::time_t> nextRotation{ 0 };
+      // Written since the file was opened (the size is seeded from the existing file)
+      uintmax_t bytesWritten{ 0 };
+      uintmax_t recordsWritten{ 0 };
+      uint32_t unflushedRecords{ 0 };
+      Format format{ Format::TEXT };
+      // Binary format: identifiers of the formats already defined in the current file, and time of the last record
+      std::unordered_map<const FormatDescriptor*, uint64_t> formatIds;
+      int64_t lastTime{ 0 };
+      // Rendering buffer of the writer
+      std::string scratch;
+      // Read by the logging calls while they pin the table, replaced by setAsync (see _retireAsync)
+      std::atomic<AsyncWriter*> async{ nullptr };
+      // Text file written through memory mapped segments instead of the stream
+      std::unique_ptr<MappedFile> mapped;
+      LogFile* file{ nullptr };
+      // Batch of records being written by the async writer: they point to the records, or to the arena for the transient data.
+      // An arena piece has a null pointer and its offset as size of the previous pieces
+      bool batching{ false };
+      std::vector<std::pair<const char*, size_t>> pieces;
+      std::string arena;
+      std::vector<std::string_view> views;
+
+      LogSink(std::ostream& strPtr) : stream{ &strPtr } {}
+      LogSink(const std::string& fileName, Policy policy, uint8_t maxNumFiles = 0, uintmax_t maxSize = 0, Format format = Format::TEXT)
+        : fileName{ fileName }, maxSize{ policy == Policy::MAX_RECORDS ? 0 : maxSize }, maxRecords{ policy == Policy::MAX_RECORDS ? maxSize : 0 },
+        maxNumFiles{ (policy == Policy::MAX_SIZE || policy == Policy::MAX_RECORDS) && maxSize ? std::max(maxNumFiles, static_cast<uint8_t>(2)) : static_cast<uint8_t>(0) }, format{ format } {
+
+#ifdef LOGGER_HAS_MMAP
+        if (_mappedSegmentSize && format == Format::TEXT)
+          mapped = std::make_unique<MappedFile>(fileName, this->maxSize ? static_cast<size_t>(this->maxSize) : _mappedSegmentSize, this->maxSize != 0);
+#endif
+        if (policy == Policy::DAILY) {
+          std::time_t timestamp;
+          if (std::filesystem::exists(fileName)) {
+            auto lastWrite = std::filesystem::last_write_time(fileName);
+            auto timedif = decltype(lastWrite)::clock::now() - lastWrite;
+            timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() - timedif);
+          }
+          else {
+            timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+          }
+          std::stringstream strTM;
+          auto tm{ _localTime(timestamp) };
+          strTM << std::put_time(&tm, "%Y%m%d");
+          creationDate = strTM.str();
+          nextRotation = _nextMidnight(timestamp);
+
+          open();
+
+          _scheduleDailyRotation(*this);
+        }
+        else
+          open();
+      }
+
+      // (Re)opens the file. A mapped file needs at least minCapacity bytes in its first segment
+      void open(size_t minCapacity = 0) {
+        if (mapped)
+          mapped->open(minCapacity);
+        else
+          stream = file = _openLogFile(fileName, format);
+        bytesWritten = std::filesystem::file_size(fileName);
+        recordsWritten = 0;
+        if (format == Format::BINARY) _writeBinarySegment(*this);
+      }
+
+      void close() {
+        if (mapped)
+          mapped->close();
+        else if (file) {
+          submit();
+          file->close();
+          delete file;
+          stream = file = nullptr;
+        }
+      }
+
+      bool dailyRotationDue(std::chrono::system_clock::time_point time) const {
+        auto next{ nextRotation.load(std::memory_order_relaxed) };
+        return next && std::chrono::system_clock::to_time_t(time) >= next;
+      }
+
+      std::chrono::milliseconds untilRotation() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::from_time_t(nextRotation.load()) - std::chrono::system_clock::now());
+      }
+
+      // The mapped files rotate by size when their segment is full
+      bool rotationDue() const {
+        return (maxSize && !mapped && bytesWritten > maxSize) || (maxRecords && recordsWritten >= maxRecords);
+      }
+
+      // Transient data is overwritten after the call, so it is copied if the record is batched
+      void put(std::string_view data, bool transient = true) {
+        if (mapped)
+          _writeMapped(*this, data, true);
+        else if (batching && file) {
+          if (transient) {
+            pieces.emplace_back(nullptr, data.size());
+            arena.append(data);
+          }
+          else
+            pieces.emplace_back(data.data(), data.size());
+        }
+        // No stream if the file could not be opened again after a rotation: the data is lost
+        else if (stream)
+          stream->write(data.data(), static_cast<std::streamsize>(data.size()));
+        bytesWritten += data.size();
+      }
+
+      void write(std::string_view record, bool transient = true) {
+        put(record, transient);
+        ++recordsWritten;
+      }
+
+      // Writes the batch at once
+      void submit() {
+        if (pieces.empty()) return;
+        views.clear();
+        size_t offset{ 0 };
+        for (auto& piece : pieces) {
+          if (piece.first)
+            views.emplace_back(piece.first, piece.second);
+          else {
+            views.emplace_back(arena.data() + offset, piece.second);
+            offset += piece.second;
+          }
+        }
+        file->writeBatch(views);
+        pieces.clear();
+        arena.clear();
+      }
+
+      // The data of a mapped file is in the page cache as soon as it is copied
+      void flush() {
+        submit();
+        if (stream) stream->flush();
+      }
+
+      LogSink(const LogSink& ls) = delete;
+      LogSink(LogSink&& ls) = delete;
+
+      ~LogSink() {
+        if (nextRotation.load()) _cancel(this);
+        delete async.exchange(nullptr);
+        if (fileName != "" && !mapped) delete file;
+      }
+
+      // Installs a new async writer (none for capacity 0) and returns the previous one, which the logging calls may still be using
+      std::unique_ptr<AsyncWriter> replaceAsync(size_t capacity, Overflow overflow, size_t shards) {
+        std::unique_ptr<AsyncWriter> writer;
+        if (capacity) {
+          writer = std::make_unique<AsyncWriter>(capacity, overflow, std::max<size_t>(shards, 1));
+          writer->thread = std::thread(&Logger::_asyncWriterThread, std::ref(*this), std::ref(*writer));
+        }
+        return std::unique_ptr<AsyncWriter>(async.exchange(writer.release()));
+      }
+    };
+    
+    inline static const std::string _LEVEL_NAMES[]{ "DEBUG", "INFO", "ERROR", "PROFILING" };
+    inline static const std::string _HEADERS[]{ "DEBUG: ", "INFO: ", "*** ERROR!\n                         " };
+    inline static const std::string _SINGLE_LINE_HEADERS[]{ "DEBUG: ", "INFO: ", "*** ERROR! " };
+    inline static std::atomic<bool> _singleLine{ false };
+    // Text header written by setLayout (nullptr: the default layout, written by _appendHeader)
+    inline static std::atomic<void (*)(std::string&, const Record&)> _layout{ nullptr };
+    inline static std::atomic<unsigned> _layoutFields{ 0 };
+    inline static std::atomic<uint64_t> _sequence{ 0 };
+    inline static std::atomic<uint32_t> _nextThreadId{ 0 };
+    // Call site of the last record admitted by the logging macros in the thread, if the layout writes the locations
+    inline static thread_local const CallSite* _callSite{ nullptr };
+
+    // A layout has no element after Msg
+    template <typename... ELEMENTS>
+    static constexpr bool _msgLast() {
+      const bool msg[]{ false, std::is_same_v<ELEMENTS, Msg>... };
+      for (size_t i = 1; i < sizeof...(ELEMENTS); ++i) {
+        if (msg[i]) return false;
+      }
+      return true;
+    }
+
+    inline static std::string _dateTimeFormat{ "%F %T" };
+    inline static std::mutex _dateTimeFormatMutex;
+    inline static std::atomic<uint32_t> _dateTimeFormatVersion{ 0 };
+
+    // Aggregated durations of a named timer, in nanoseconds
+    struct TimerStats {
+      // Log-linear histogram: exact below 16ns, then 8 buckets per power of 2 (maximum error 6%)
+      inline static constexpr size_t BUCKETS{ 16 + 60 * 8 };
+
+      uint64_t count{ 0 };
+      int64_t min{ INT64_MAX };
+      int64_t max{ 0 };
+      double sum{ 0 };
+      std::array<uint32_t, BUCKETS> histogram{};
+
+      static size_t bucket(int64_t duration) {
+        auto value{ static_cast<uint64_t>(std::max<int64_t>(duration, 0)) };
+        if (value < 16) return static_cast<size_t>(value);
+        unsigned msb{ 4 };
+        while (msb < 63 && (value >> (msb + 1))) ++msb;
+        return std::min(BUCKETS - 1, 16 + (msb - 4) * 8 + static_cast<size_t>((value >> (msb - 3)) & 7));
+      }
+
+      static int64_t bucketValue(size_t index) {
+        if (index < 16) return static_cast<int64_t>(index);
+        auto msb{ 4 + (index - 16) / 8 };
+        auto lower{ (static_cast<uint64_t>(8 + (index - 16) % 8)) << (msb - 3) };
+        return static_cast<int64_t>(lower + (1ull << (msb - 3)) / 2);
+      }
+
+      void add(int64_t duration) {
+        ++count;
+        min = std::min(min, duration);
+        max = std::max(max, duration);
+        sum += static_cast<double>(duration);
+        ++histogram[bucket(duration)];
+      }
+
+      void merge(const TimerStats& other) {
+        count += other.count;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        sum += other.sum;
+        for (size_t i = 0; i < BUCKETS; ++i) histogram[i] += other.histogram[i];
+      }
+
+      int64_t percentile(double fraction) const {
+        auto target{ static_cast<uint64_t>(fraction * static_cast<double>(count - 1)) + 1 };
+        uint64_t accumulated{ 0 };
+        for (size_t i = 0; i < BUCKETS; ++i) {
+          accumulated += histogram[i];
+          if (accumulated >= target) return std::clamp(bucketValue(i), min, max);
+        }
+        return max;
+      }
+    };
+
+    using TimerStatsMap = std::map<std::string, TimerStats, std::less<>>;
+
+    // Timers of a thread: the stack of started timers and the statistics of its named timers
+    struct ThreadTimers {
+      std::mutex ttm;
+      std::vector<std::chrono::high_resolution_clock::time_point> started;
+      TimerStatsMap stats;
+
+      ThreadTimers() {
+        started.reserve(16);
+        std::lock_guard<std::mutex> lock(_timersMutex);
+        _threadTimers.push_back(this);
+      }
+
+      ~ThreadTimers() {
+        std::lock_guard<std::mutex> lock(_timersMutex);
+        for (auto& named : stats) _retiredTimerStats[named.first].merge(named.second);
+        _threadTimers.erase(std::find(_threadTimers.begin(), _threadTimers.end(), this));
+      }
+    };
+
+    inline static std::mutex _timersMutex;
+    inline static std::vector<ThreadTimers*> _threadTimers;
+    // Statistics of the threads already finished
+    inline static TimerStatsMap _retiredTimerStats;
+    inline static std::atomic<uint32_t> _timerStatsInterval{ 0 };
+
+    inline static ThreadTimers& _timers();
+
+    // Instrumentation of a thread. Only written by its thread (relaxed load and store, no read-modify-write), and read by stats().
+    // The statistics of the finished threads are shared by the threads logging while they exit: they are updated atomically
+    struct alignas(64) ThreadStats {
+      std::array<std::atomic<uint64_t>, 4> records;
+      std::array<std::atomic<uint64_t>, 4> bytes;
+      std::array<std::atomic<uint64_t>, 4> suppressed;
+      std::array<std::atomic<uint64_t>, 4> dropped;
+      std::atomic<uint64_t> lockWaits;
+      std::atomic<uint64_t> lockWaitTime;
+      // Latency of the logging calls (ns), with the buckets of TimerStats
+      std::atomic<uint64_t> latencyCount;
+      std::atomic<int64_t> latencyMin;
+      std::atomic<int64_t> latencyMax;
+      std::atomic<uint64_t> latencySum;
+      std::array<std::atomic<uint32_t>, TimerStats::BUCKETS> latency;
+      // Epoch of the sink table pinned by the thread (0 if none), read by the retirement of the replaced tables
+      std::atomic<uint64_t> pinned;
+      const bool shared;
+
+      explicit ThreadStats(bool shared = false) : records{}, bytes{}, suppressed{}, dropped{}, lockWaits{ 0 }, lockWaitTime{ 0 }, latencyCount{ 0 },
+        latencyMin{ INT64_MAX }, latencyMax{ 0 }, latencySum{ 0 }, latency{}, pinned{ 0 }, shared{ shared } {}
+
+      template <typename T, typename V>
+      void add(std::atomic<T>& counter, V value) {
+        if (LOGGER_UNLIKELY(shared))
+          counter.fetch_add(static_cast<T>(value), std::memory_order_relaxed);
+        else
+          counter.store(counter.load(std::memory_order_relaxed) + static_cast<T>(value), std::memory_order_relaxed);
+      }
+
+      // Keeps the lowest (or highest with "greater") value
+      template <typename COMPARE>
+      void keep(std::atomic<int64_t>& extreme, int64_t value, COMPARE better) {
+        auto current{ extreme.load(std::memory_order_relaxed) };
+        if (LOGGER_UNLIKELY(shared)) {
+          while (better(value, current) && !extreme.compare_exchange_weak(current, value, std::memory_order_relaxed));
+        }
+        else if (better(value, current))
+          extreme.store(value, std::memory_order_relaxed);
+      }
+
+      void addLatency(int64_t duration) {
+        duration = std::max<int64_t>(duration, 0);
+        add(latencyCount, 1);
+        add(latencySum, duration);
+        keep(latencyMin, duration, std::less<int64_t>());
+        keep(latencyMax, duration, std::greater<int64_t>());
+        add(latency[TimerStats::bucket(duration)], 1);
+      }
+
+      void merge(const ThreadStats& other) {
+        for (size_t level = 0; level < records.size(); ++level) {
+          add(records[level], other.records[level].load(std::memory_order_relaxed));
+          add(bytes[level], other.bytes[level].load(std::memory_order_relaxed));
+          add(suppressed[level], other.suppressed[level].load(std::memory_order_relaxed));
+          add(dropped[level], other.dropped[level].load(std::memory_order_relaxed));
+        }
+        add(lockWaits, other.lockWaits.load(std::memory_order_relaxed));
+        add(lockWaitTime, other.lockWaitTime.load(std::memory_order_relaxed));
+        add(latencyCount, other.latencyCount.load(std::memory_order_relaxed));
+        add(latencySum, other.latencySum.load(std::memory_order_relaxed));
+        keep(latencyMin, other.latencyMin.load(std::memory_order_relaxed), std::less<int64_t>());
+        keep(latencyMax, other.latencyMax.load(std::memory_order_relaxed), std::greater<int64_t>());
+        for (size_t i = 0; i < latency.size(); ++i) add(latency[i], other.latency[i].load(std::memory_order_relaxed));
+      }
+    };
+
+    // Registers the statistics of a thread, and merges them into _exitedStats when the thread finishes
+    struct ThreadStatsHolder {
+      ThreadStats stats;
+
+      ThreadStatsHolder() {
+        std::lock_guard<std::mutex> lock(_statsMutex);
+        _threadStats.push_back(&stats);
+      }
+
+      ~ThreadStatsHolder() {
+        std::lock_guard<std::mutex> lock(_statsMutex);
+        _exitedStats.merge(stats);
+        _threadStats.erase(std::find(_threadStats.begin(), _threadStats.end(), &stats));
+        // Records logged later by the thread (e.g. from destructors) are counted in the statistics of the finished threads
+        _currentStats = &_exitedStats;
+      }
+    };
+
+    inline static std::mutex _statsMutex;
+    inline static std::vector<ThreadStats*> _threadStats;
+    inline static ThreadStats _exitedStats{ true };
+    inline static thread_local ThreadStats* _currentStats{ nullptr };
+    inline static std::atomic<uint64_t> _rotations{ 0 };
+    inline static std::atomic<uint64_t> _rotationTime{ 0 };
+    inline static std::atomic<uint32_t> _statsInterval{ 0 };
+
+    inline static ThreadStats& _stats();
+
+    // Last DEBUG records of a thread, kept instead of being written (see setFlightRecorder). The records are swapped in and out
+    // of the slots, so their buffers are reused. Locked by the thread and by dumpRecent()
+    struct FlightRecorder {
+      std::mutex fm;
+      std::vector<Record> records;
+      // Slot of the next record (the oldest one when it is full)
+      size_t next{ 0 };
+      size_t count{ 0 };
+
+      void push(Record& record, size_t capacity) {
+        std::lock_guard<std::mutex> lock(fm);
+        if (records.size() != capacity) {
+          records.clear();
+          records.resize(capacity);
+          next = count = 0;
+        }
+        records[next].swap(record);
+        next = (next + 1) % capacity;
+        count = std::min(count + 1, capacity);
+      }
+
+      // Moves the records out, the oldest first
+      void take(std::vector<Record>& out) {
+        std::lock_guard<std::mutex> lock(fm);
+        for (size_t i = 0; i < count; ++i) {
+          out.emplace_back();
+          out.back().swap(records[(next + records.size() - count + i) % records.size()]);
+        }
+        count = 0;
+      }
+    };
+
+    struct FlightRecorderHolder {
+      FlightRecorder recorder;
+
+      FlightRecorderHolder() {
+        std::lock_guard<std::mutex> lock(_flightMutex);
+        _flightRecorders.push_back(&recorder);
+      }
+
+      ~FlightRecorderHolder() {
+        std::lock_guard<std::mutex> lock(_flightMutex);
+        _flightRecorders.erase(std::find(_flightRecorders.begin(), _flightRecorders.end(), &recorder));
+        // The records logged later by the thread (e.g. from destructors) are written
+        _currentRecorder = nullptr;
+        _recorderExited = true;
+      }
+    };
+
+    inline static std::atomic<size_t> _flightRecords{ 0 };
+    inline static std::mutex _flightMutex;
+    inline static std::vector<FlightRecorder*> _flightRecorders;
+    inline static thread_local FlightRecorder* _currentRecorder{ nullptr };
+    inline static thread_local bool _recorderExited{ false };
+
+    // nullptr once the thread is finishing
+    inline static FlightRecorder* _flightRecorder();
+
+    // Locks the log file, accounting the time waited if it is contended
+    inline static std::unique_lock<std::mutex> _lockSink(LogSink& sink);
+            
+    // Background thread archiving the rotated files, out of the lock of the sinks. Declared before
+    // the sinks, so that it outlives the async writers flushing their last records
+    struct Maintenance {
+      std::mutex mm;
+      std::condition_variable cv;
+      std::condition_variable idleCv;
+      std::deque<std::function<void()>> tasks;
+      // Keeps the pending file names unique
+      std::atomic<uint64_t> sequence;
+      bool busy;
+      bool stop;
+      // Runs only when a core is idle (on Linux)
+      bool idle;
+      std::thread thread;
+
+      Maintenance(bool idlePriority) : sequence{ 0 }, busy{ false }, stop{ false }, idle{ idlePriority } {}
+
+      ~Maintenance() {
+        if (thread.joinable()) {
+          {
+            std::lock_guard<std::mutex> lock(mm);
+            stop = true;
+            cv.notify_one();
+          }
+          thread.join();
+        }
+      }
+
+      void waitIdle() {
+        std::unique_lock<std::mutex> lock(mm);
+        idleCv.wait(lock, [this]() { return tasks.empty() && !busy; });
+      }
+    };
+    inline static Maintenance _maintenance{ false };
+    // Compression competes with the application for the CPU: it has its own thread at idle priority, which hands the compressed files
+    // back to the maintenance thread. Declared after it, so that its last files are still archived when it is destroyed
+    inline static Maintenance _compressor{ true };
+
+    // Timer wheel running the periodic tasks of all the sinks in a single thread: daily rotations, interval flushes, and the dumps of the
+    // statistics and of the suppressed records (the archiving and the compression go on in their own threads).
+    // Declared before the sinks, which cancel their timers when they are destroyed
+    struct Scheduler {
+      // 256 slots of 16 ms: a timer further away than a turn (about 4 s) stays in its slot until its tick comes
+      inline static constexpr size_t SLOTS{ 256 };
+      inline static constexpr std::chrono::milliseconds TICK{ 16 };
+
+      struct Timer {
+        const void* key;
+        uint64_t due;
+        std::function<std::chrono::milliseconds()> task;
+      };
+
+      std::mutex sm;
+      std::condition_variable cv;
+      std::condition_variable idleCv;
+      std::array<std::vector<Timer>, SLOTS> wheel;
+      // Tick of each timer, to find its slot
+      std::unordered_map<const void*, uint64_t> due;
+      std::chrono::steady_clock::time_point start;
+      // Last tick processed
+      uint64_t tick;
+      const void* running;
+      // The running task was cancelled or rescheduled while it ran
+      bool replaced;
+      bool stop;
+      std::thread thread;
+
+      Scheduler() : start{ std::chrono::steady_clock::now() }, tick{ 0 }, running{ nullptr }, replaced{ false }, stop{ false } {}
+
+      ~Scheduler() {
+        halt();
+      }
+
+      uint64_t now() const {
+        return static_cast<uint64_t>((std::chrono::steady_clock::now() - start) / TICK);
+      }
+
+      // With the lock
+      void remove(const void* key) {
+        auto timer{ due.find(key) };
+        if (timer == due.end()) return;
+        auto& slot{ wheel[timer->second % SLOTS] };
+        slot.erase(std::find_if(slot.begin(), slot.end(), [key](const Timer& entry) { return entry.key == key; }));
+        due.erase(timer);
+      }
+
+      // With the lock. A delay already elapsed (e.g. the rotation of a file left from an earlier day) runs at the next tick
+      void insert(const void* key, std::chrono::milliseconds delay, std::function<std::chrono::milliseconds()> task) {
+        auto ticks{ delay.count() > 0 ? std::max<uint64_t>(static_cast<uint64_t>((delay + TICK - std::chrono::milliseconds(1)) / TICK), 1) : 1 };
+        auto at{ now() + ticks };
+        wheel[at % SLOTS].push_back(Timer{ key, at, std::move(task) });
+        due[key] = at;
+      }
+
+      void halt() {
+        if (thread.joinable()) {
+          {
+            std::lock_guard<std::mutex> lock(sm);
+            stop = true;
+            cv.notify_one();
+          }
+          thread.join();
+        }
+      }
+    };
+    inline static Scheduler _scheduler;
+
+    inline static std::shared_ptr<LogSink> defLogSink{ new LogSink(std::cout) };
+    inline static std::shared_ptr<LogSink> defErrLogSink{ new LogSink(std::cerr) };
+
+    // Log sink of each level and sinks added to each level, replaced as a whole (copy, modify and publish) by the configuration
+    struct SinkTable {
+      std::array<std::shared_ptr<LogSink>, 4> sinks;
+      std::array<std::vector<std::shared_ptr<Sink>>, 4> outputs;
+    };
+
+    struct CurrentTable {
+      std::atomic<SinkTable*> table;
+
+      CurrentTable() : table{ new SinkTable{ { defLogSink, defLogSink, defErrLogSink, defLogSink }, {} } } {}
+
+      ~CurrentTable() {
+        // The periodic tasks use the sinks
+        _scheduler.halt();
+        delete table.load();
+      }
+    };
+    // Log sinks of the files, also the replaced ones still draining their records, until they are destroyed (and their files closed).
+    // Declared before the table, which releases its sinks when it is destroyed
+    inline static std::mutex _fileSinksMutex;
+    inline static std::condition_variable _fileSinksCv;
+    inline static std::vector<std::pair<std::string, std::weak_ptr<LogSink>>> _fileSinks;
+
+    inline static CurrentTable _current;
+    // Incremented by each publication: a replaced table is released once no thread has pinned it with an older epoch
+    inline static std::atomic<uint64_t> _tableEpoch{ 1 };
+    // Pins of the threads already finished (their statistics are shared)
+    inline static std::atomic<uint32_t> _exitedPins{ 0 };
+    inline static thread_local uint32_t _pinDepth{ 0 };
+    inline static std::mutex _configMutex;
+
+    // Pins the current sink table during a logging call (RCU style: an epoch store and a load, no shared counter)
+    struct TablePin {
+      ThreadStats& stats;
+      SinkTable* table;
+
+      TablePin() : stats{ _stats() } {
+        if (!_pinDepth++) {
+          if (&stats == &_exitedStats)
+            _exitedPins.fetch_add(1);
+          else
+            stats.pinned.store(_tableEpoch.load());
+        }
+        table = _current.table.load();
+      }
+
+      TablePin(const TablePin&) = delete;
+      TablePin& operator=(const TablePin&) = delete;
+
+      ~TablePin() {
+        if (!--_pinDepth) {
+          if (&stats == &_exitedStats)
+            _exitedPins.fetch_sub(1);
+          else
+            stats.pinned.store(0, std::memory_order_release);
+        }
+      }
+    };
+
+    // Replaces the table, and releases the old one in the maintenance thread: its sinks which are not used anymore drain their records and close
+    inline static void _publish(std::unique_ptr<SinkTable> table);
+
+    // Releases the async writers replaced by setAsync in the maintenance thread, once no logging call may be pushing to them
+    inline static void _retireAsync(std::vector<std::pair<std::shared_ptr<LogSink>, std::unique_ptr<AsyncWriter>>> writers);
+
+    // Waits until no logging call pins the table at an epoch older than "epoch"
+    inline static void _waitUnpinned(uint64_t epoch);
+
+    // The configuration calls wait for the logging calls in progress: made while logging (from a sink, or from the formatting of
+    // a logged value), they would wait for themselves, so they throw instead
+    inline static void _checkNotLogging(const char* function);
+
+    inline static std::unique_ptr<SinkTable> _copyTable();
+
+    // The sink of the file if it is already open (in the table, or replaced and still draining), or a new one. A file is never
+    // written by two sinks: it is shared, with the settings it was opened with
+    inline static std::shared_ptr<LogSink> _openSink(const SinkTable& table, const std::string& fileName, Policy policy, uint8_t maxNumFiles, uintmax_t maxSize, Format format);
+
+    inline static size_t _asyncCapacity{ 0 };
+    inline static Overflow _asyncOverflow{ Overflow::BLOCK };
+    inline static size_t _asyncShards{ 1 };
+    inline static std::atomic<size_t> _nextShard{ 0 };
+    inline static size_t _mappedSegmentSize{ 0 };
+    inline static std::atomic<size_t> _batchRecords{ 256 };
+    inline static std::atomic<size_t> _batchBytes{ 1 << 20 };
+    inline static std::atomic<uint32_t> _batchDelay{ 0 };
+    inline static std::atomic<bool> _ioUring{ false };
+
+    struct FlushPolicy {
+      std::atomic<Flush> policy;
+      std::atomic<uint32_t> value;
+
+      FlushPolicy() : policy{ Flush::IMMEDIATE }, value{ 0 } {}
+    };
+    inline static std::array<FlushPolicy, 4> _flushPolicies;
+
+    // Token bucket: "rate" records per second, with bursts of up to "burst" records (0 for "rate"). A rate of 0 disables it
+    struct RateLimit {
+      std::atomic<uint32_t> rate;
+      std::atomic<uint32_t> burst;
+
+      RateLimit() : rate{ 0 }, burst{ 0 } {}
+    };
+
+    // Tokens of a rate limit left to a thread
+    struct TokenBucket {
+      double tokens;
+      std::chrono::steady_clock::time_point last;
+      bool started;
+
+      TokenBucket() : tokens{ 0 }, started{ false } {}
+
+      bool take(const RateLimit& limit, std::chrono::steady_clock::time_point now) {
+        auto rate{ limit.rate.load(std::memory_order_relaxed) };
+        if (!rate) return true;
+        auto burst{ limit.burst.load(std::memory_order_relaxed) };
+        auto capacity{ static_cast<double>(burst ? burst : rate) };
+        tokens = started ? std::min(capacity, tokens + std::chrono::duration<double>(now - last).count() * rate) : capacity;
+        started = true;
+        last = now;
+        if (tokens < 1) return false;
+        tokens -= 1;
+        return true;
+      }
+    };
+
+    inline static std::array<RateLimit, 4> _levelLimits;
+    inline static RateLimit _callSiteLimit;
+    // 1 in N records of each level are written (0 or 1 to write all of them)
+    inline static std::array<std::atomic<uint32_t>, 4> _sampling{};
+    // Set when there is any limit or sampling, so that the statements skip the checks otherwise
+    inline static std::atomic<bool> _limiting{ false };
+    // Records dropped by the rate limit of each level, reported by the scheduler
+    inline static std::array<std::atomic<uint64_t>, 4> _suppressed{};
+    inline static std::atomic<uint32_t> _suppressionReportInterval{ 10000 };
+    inline static std::mutex _callSitesMutex;
+    inline static std::vector<CallSite*> _callSites;
+
+    // Applies the sampling and the rate limits to a record of the call site
+    inline static bool _admit(LogLevel level, CallSiteState& state);
+
+    inline static void _reportSuppressed();
+
+    inline static void _updateLimiting();
+
+    // Crash handler: the pending records are rendered in a buffer reserved when it is installed, and the previous handlers are restored to re-raise
+#ifdef LOGGER_HAS_SIGACTION
+    inline static constexpr int _CRASH_SIGNALS[]{ SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    inline static constexpr const char* _CRASH_SIGNAL_NAMES[]{ "SIGSEGV", "SIGBUS", "SIGFPE", "SIGILL", "SIGABRT" };
+    inline static std::array<struct sigaction, std::size(_CRASH_SIGNALS)> _previousActions{};
+    // Alternate stack of the thread installing the handler, for its stack overflows
+    inline static std::vector<char> _crashStack;
+    // localtime is not async-signal-safe: the timestamps use the UTC offset of the installation
+    inline static long _crashUtcOffset{ 0 };
+#else
+    inline static constexpr int _CRASH_SIGNALS[]{ SIGSEGV, SIGFPE, SIGILL, SIGABRT };
+    inline static constexpr const char* _CRASH_SIGNAL_NAMES[]{ "SIGSEGV", "SIGFPE", "SIGILL", "SIGABRT" };
+    inline static std::array<void (*)(int), std::size(_CRASH_SIGNALS)> _previousHandlers{};
+#endif
+    inline static std::atomic<bool> _crashHandlerInstalled{ false };
+    // Set by the first crash: a crash in another thread waits for the drain, a crash during the drain only re-raises
+    inline static std::atomic<bool> _crashing{ false };
+    inline static std::atomic<bool> _crashDrained{ false };
+    inline static std::terminate_handler _previousTerminate{ nullptr };
+    inline static std::string _crashText;
+    inline static std::unique_ptr<Record> _crashRecord;
+
+    inline static void _onCrashSignal(int signal);
+
+    [[noreturn]] inline static void _onTerminate();
+
+    inline static void _crash(std::string_view reason);
+
+    // Writes the records pending in the async rings and in the buffers of the log files, and a final marker record, without allocating
+    inline static void _drainOnCrash(std::string_view reason);
+
+    inline static void _crashWrite(LogSink& sink, std::string_view data);
+
+    inline static void _appendCrashHeader(std::string& out, LogLevel level, std::chrono::system_clock::time_point time, Format format);
+
+
+    inline static void _maintenanceThread(Maintenance& worker);
+
+    inline static void _maintain(std::function<void()> task, Maintenance& worker = _maintenance);
+
+    // The archive task gets the pending file name and the extension of the compressed file
+    template <typename FUNC>
+    static void _rotate(LogSink& sink, size_t minCapacity, FUNC archive);
+
+    // Compresses the file into the file plus the extension of the codec, and removes it. Returns the extension
+    inline static const std::string& _compress(const std::string& fileName, Compression codec, [[maybe_unused]] int level);
+
+    inline static void _asyncWriterThread(LogSink& sink, AsyncWriter& async);
+
+    // Pops the next batch of records of an async writer. Returns its size
+    inline static size_t _fillBatch(AsyncWriter& async, std::vector<Record>& batch);
+
+    template <typename FUNC>
+    static void _forEachSink(FUNC func);
+
+    template <typename FUNC>
+    static void _forEachSink(const SinkTable& table, FUNC func);
+
+    // Sink of the records of a level: the DEBUG records of the flight recorder are formatted for the ERROR sink
+    inline static LogSink& _levelSink(const SinkTable& table, LogLevel level) {
+      return *table.sinks[level == DEBUG && _flightRecords.load(std::memory_order_relaxed) ? ERROR : level];
+    }
+
+    // Keeps the DEBUG records in the flight recorder, and writes its records before an ERROR record of the thread
+    inline static void _commit(LogSink& sink, Record& record);
+
+    inline static void _commitRecord(LogSink& sink, Record& record);
+
+    // Replaces the packed arguments of a deferred record by its text, to share it between its log sink and the added sinks
+    inline static void _renderRecord(Record& record);
+
+    // Sinks being called by the thread, innermost last
+    inline static thread_local std::vector<Sink*> _callingSinks;
+
+    // Marks a sink as being called by the thread, while it is called
+    struct SinkCall {
+      SinkCall(Sink& sink) {
+        _callingSinks.push_back(&sink);
+      }
+
+      SinkCall(const SinkCall&) = delete;
+      SinkCall& operator=(const SinkCall&) = delete;
+
+      ~SinkCall() {
+        _callingSinks.pop_back();
+      }
+
+      static bool active(const Sink* sink) {
+        return std::find(_callingSinks.begin(), _callingSinks.end(), sink) != _callingSinks.end();
+      }
+    };
+
+    // Gives the records to the sinks added to their levels
+    inline static void _fanOut(Record* records, size_t count);
+
+    template <typename FUNC>
+    static void _forEachOutput(FUNC func);
+
+    inline static bool _flushDue(LogSink& sink, LogLevel level);
+
+    inline static void _schedulerThread();
+
+    // Runs the task after the delay, and then again after each delay it returns (0 to stop). Replaces the timer with the same key
+    inline static void _schedule(const void* key, std::chrono::milliseconds delay, std::function<std::chrono::milliseconds()> task);
+
+    // Removes the timer, waiting for its task if it is running
+    inline static void _cancel(const void* key);
+
+    inline static void _scheduleSuppressionReport();
+
+    // With the lock of the sink: the records of the new day go to a new file, the rotated one is named after the day it was created
+    inline static void _dailyRotation(LogSink& sink, std::time_t now);
+
+    // The writers rotate the file with the first record of the day, the scheduler if there is none
+    inline static void _scheduleDailyRotation(LogSink& sink);
+
+    inline static std::time_t _nextMidnight(std::time_t timestamp);
+
+    inline static std::tm _localTime(std::time_t timestamp);
+
+    inline static void _appendTimestamp(std::string& out, std::chrono::system_clock::time_point now);
+
+    // Date and time of the second of "now", in the format of setDateTimeFormat (cached per thread)
+    inline static const std::string& _timestampText(std::chrono::system_clock::time_point now);
+
+    // Number of the calling thread (1, 2...)
+    inline static uint32_t _threadId();
+
+    // JSON: opens the record object, up to the value of the message. The text header uses the default layout
+    inline static void _appendHeader(std::string& out, LogLevel level, std::chrono::system_clock::time_point time = std::chrono::system_clock::now(),
+      Format format = Format::TEXT);
+
+    // Text: with the layout set by setLayout
+    inline static void _appendHeader(std::string& out, const Record& record, Format format);
+
+    // Ends the record, whose message starts at "message" (JSON: escapes the message and closes the object)
+    inline static void _appendFooter(std::string& out, size_t message, Format format);
+
+    // Text header of the level (without the new line of the ERROR level in the single line mode)
+    inline static const std::string& _header(LogLevel level) { return (_singleLine.load(std::memory_order_relaxed) ? _SINGLE_LINE_HEADERS : _HEADERS)[level]; }
+
+    // Escapes the end of the string, from "from", as the content of a JSON string (in place, it is only copied if there is anything to escape).
+    // The invalid UTF-8 bytes are replaced with \ufffd
+    inline static void _escapeJson(std::string& out, size_t from);
+
+    // Single line mode: escapes the ends of line of the end of the string as \n and \r
+    inline static void _escapeLines(std::string& out, size_t from);
+
+    // First character of [p, end) to escape. JSON: quotes, backslashes, control and non ASCII characters (to be validated); otherwise the ends of line
+    template <bool JSON>
+    static const char* _findEscape(const char* p, const char* end);
+
+    // 16 bytes at a time (SSE2 or NEON), and the tail byte by byte
+    template <bool JSON>
+    static const char* _findEscape16(const char* p, const char* end);
+
+#ifdef LOGGER_HAS_AVX2
+    template <bool JSON>
+    __attribute__((target("avx2"))) static const char* _findEscape32(const char* p, const char* end);
+#endif
+
+    // Length of the valid UTF-8 sequence starting at p, 0 if it is not valid (overlong, surrogate, out of range or truncated)
+    inline static size_t _utf8Length(const char* p, const char* end);
+
+#ifdef LOGGER_HAS_SSE2
+    inline static unsigned _firstBit(uint32_t bits);
+#endif
+
+    template <typename T>
+    static void _appendJsonValue(std::string& out, const T& value);
+
+    inline static void _appendFields(std::string&, bool) {}
+
+    template <typename KEY, typename VALUE, typename... FIELDS>
+    static void _appendFields(std::string& out, bool json, const KEY& key, const VALUE& value, const FIELDS&... fields);
+
+    inline static std::atomic<LogLevel> _level{ LogLevel::DEBUG };
+
+    static constexpr size_t _countPlaceholders(std::string_view format);
+
+    inline static std::string_view _appendLiteral(std::string& out, std::string_view format);
+
+    template <typename T>
+    static std::string_view _stringView(const T& value);
+
+    template <typename T>
+    static void _appendValue(std::string& out, const T& value);
+
+    inline static void _appendFormatted(std::string& out, std::string_view format);
+
+    template <typename T, typename... ARGS>
+    static void _appendFormatted(std::string& out, std::string_view format, const T& value, const ARGS&... args);
+
+    template <typename T>
+    static constexpr char _typeCode();
+
+    template <typename T>
+    static void _packValue(std::string& out, const T& value);
+
+    inline static bool _renderDeferred(std::string& out, std::string_view format, std::string_view signature, std::string_view args);
+
+    static void _sizeRotation(LogSink& sink, size_t minCapacity = 0);
+
+    inline static void _writeMapped(LogSink& sink, std::string_view data, bool locked);
+        
+    static void _write(LogLevel level, std::string_view trace);
+
+
+    static LogFile* _openLogFile(const std::string& fileName, Format format = Format::TEXT);
+
+    // Binary log files: a sequence of entries, with a SEGMENT entry each time the file is opened
+    //   SEGMENT: 'S' "LOGB" version(1 byte) little endian(1 byte) base time(varint, microseconds since the epoch)
+    //   FORMAT:  'F' id(varint) length(varint) format length(varint) signature
+    //   RECORD:  'R' id(varint) level(1 byte) time delta(zigzag varint, microseconds) length(varint) packed arguments
+    //   TEXT:    'T' length(varint) formatted record
+    inline static constexpr uint8_t _BINARY_VERSION{ 1 };
+
+    // Extensions of the rotated files, by compression codec
+    inline static const std::string _EXTENSIONS[]{ "", ".gz", ".zst" };
+    inline static std::atomic<Compression> _compression{ Compression::NONE };
+    inline static std::atomic<int> _compressionLevel{ 0 };
+
+    inline static void _appendVarint(std::string& out, uint64_t value);
+
+    inline static void _writeBinarySegment(LogSink& sink);
+
+    inline static void _writeBinary(LogSink& sink, const Record& record);
+
+    inline static void _writeRecord(LogSink& sink, const Record& record);
+
+    Logger() = delete;
+            
+  public:
+    // Record of the stream-style logging (debugOut, infoOut, errorOut): the line is built in a thread-local buffer
+    // and committed to the log sink with a single write at the end of the statement
+    class RecordStream {
+      struct Buffer {
+        Record record;
+        StringBuf strBuf{ record.data };
+        std::ostream stream{ &strBuf };
+        bool inUse{ false };
+      };
+
+      LogLevel _level;
+      Buffer* _buffer;
+      std::unique_ptr<Buffer> _nested;
+      // Position of the message in the record
+      size_t _message;
+      // Exceptions in flight when the record was started: an operand throwing leaves the record partial, and it is not committed
+      int _exceptions;
+
+      // Buffers of the nested records, reused by the thread
+      static std::vector<std::unique_ptr<Buffer>>& _spareBuffers() {
+        thread_local std::vector<std::unique_ptr<Buffer>> spare;
+        return spare;
+      }
+
+    public:
+      // Disabled record: the values are ignored
+      RecordStream() : _level{ LogLevel::NONE }, _buffer{ nullptr }, _message{ 0 }, _exceptions{ 0 } {}
+
+      explicit RecordStream(LogLevel level) : _level{ level }, _buffer{ nullptr }, _message{ 0 }, _exceptions{ std::uncaught_exceptions() } {
+        thread_local Buffer buffer;
+        if (buffer.inUse) {
+          // Logging from within the << chain of another record
+          auto& spare{ _spareBuffers() };
+          if (spare.empty())
+            _nested = std::make_unique<Buffer>();
+          else {
+            _nested = std::move(spare.back());
+            spare.pop_back();
+          }
+          _buffer = _nested.get();
+        }
+        else
+          _buffer = &buffer;
+        _buffer->inUse = true;
+        _buffer->stream.flags(std::ios_base::skipws | std::ios_base::dec);
+        _buffer->stream.precision(6);
+        _buffer->stream.width(0);
+        _buffer->stream.fill(' ');
+        _buffer->record.reset(level);
+        TablePin pin;
+        _appendHeader(_buffer->record.data, _buffer->record, _levelSink(*pin.table, level).format);
+        _message = _buffer->record.data.size();
+      }
+
+      RecordStream(RecordStream&& other) noexcept
+        : _level{ other._level }, _buffer{ std::exchange(other._buffer, nullptr) }, _nested{ std::move(other._nested) }, _message{ other._message },
+        _exceptions{ other._exceptions } {}
+
+      RecordStream(const RecordStream&) = delete;
+      RecordStream& operator=(const RecordStream&) = delete;
+
+      ~RecordStream() {
+        if (!_buffer) return;
+        if (std::uncaught_exceptions() == _exceptions) {
+          // The buffer stays in use until the record is committed: a stream record logged meanwhile (e.g. by a sink) takes a nested buffer
+          try {
+            TablePin pin;
+            auto& sink{ _levelSink(*pin.table, _level) };
+            _appendFooter(_buffer->record.data, _message, sink.format);
+            _commit(sink, _buffer->record);
+          }
+          catch (const std::exception& e) {
+            // A destructor cannot report it to the caller
+            std::cerr << "Log record lost: " << e.what() << std::endl;
+          }
+          catch (...) {
+            std::cerr << "Log record lost" << std::endl;
+          }
+        }
+        _buffer->inUse = false;
+        if (_nested) _spareBuffers().push_back(std::move(_nested));
+      }
+
+      template <typename T>
+      RecordStream& operator<<(const T& value) {
+        if (_buffer) _buffer->stream << value;
+        return *this;
+      }
+
+      RecordStream& operator<<(std::ostream& (*manipulator)(std::ostream&)) {
+        if (_buffer) manipulator(_buffer->stream);
+        return *this;
+      }
+    };
+
+    // Turns the << chain of the stream macros into a void expression, so that LOGGER_STREAM can skip it
+    struct StreamGuard {
+      void operator&(const RecordStream&) const {}
+    };
+
+    // Adds the duration of its scope to the statistics of the named timer (see timerScope)
+    class ScopedTimer {
+      std::string_view _name;
+      std::chrono::high_resolution_clock::time_point _start;
+
+    public:
+      explicit ScopedTimer(std::string_view name) : _name{ name }, _start{ std::chrono::high_resolution_clock::now() } {}
+      ScopedTimer(const ScopedTimer&) = delete;
+      ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+      ~ScopedTimer() {
+        addTimerSample(_name, std::chrono::high_resolution_clock::now() - _start);
+      }
+    };
+
+    struct CallSite {
+      const char* file;
+      int line;
+      LogLevel level;
+      std::atomic<uint64_t> suppressed;
+      // File name without the directories, for the layout
+      std::string_view name;
+
+      CallSite(const char* file, int line, LogLevel level) : file{ file }, line{ line }, level{ level }, suppressed{ 0 }, name{ file } {
+        if (auto slash{ name.find_last_of("/\\") }; slash != std::string_view::npos) name.remove_prefix(slash + 1);
+        std::lock_guard<std::mutex> lock(_callSitesMutex);
+        _callSites.push_back(this);
+      }
+
+      ~CallSite() {
+        std::lock_guard<std::mutex> lock(_callSitesMutex);
+        _callSites.erase(std::find(_callSites.begin(), _callSites.end(), this));
+      }
+    };
+
+    // Tokens of a call site left to a thread
+    struct CallSiteState {
+      CallSite& site;
+      TokenBucket bucket;
+
+      explicit CallSiteState(CallSite& site) : site{ site } {}
+    };
+
+    // Checked by the logging macros before the arguments are evaluated. "site" returns the state of the call site in the thread,
+    // and it is only called when there is a rate limit or a sampling
+    template <typename SITE>
+    static bool admit(LogLevel level, SITE site) {
+      return !_limiting.load(std::memory_order_relaxed) || _admit(level, site());
+    }
+
+    // Rate limit of the records of a level, per thread (0 to disable). The dropped records are reported periodically
+    inline static void setRateLimit(LogLevel level, uint32_t recordsPerSecond, uint32_t burst = 0);
+
+    // Rate limit of the records of each logging statement, per thread (0 to disable)
+    inline static void setCallSiteRateLimit(uint32_t recordsPerSecond, uint32_t burst = 0);
+
+    // Writes only 1 in "oneInN" records of the level (e.g. for DEBUG), per thread (0 or 1 to write all of them)
+    inline static void setSampling(LogLevel level, uint32_t oneInN);
+
+    // Flight recorder: the DEBUG records are kept in memory, in a ring of the last "records" records of each thread, instead of being written
+    // (0 to disable, which discards them). They are written to the ERROR sink before the next ERROR record of the thread, or by dumpRecent()
+    inline static void setFlightRecorder(size_t records);
+
+    // Writes the records of the flight recorders of all the threads to the ERROR sink, in time order
+    inline static void dumpRecent();
+
+    // Interval of the "Suppressed N records" reports of the rate limits (10 seconds by default)
+    inline static void setSuppressionReportInterval(std::chrono::milliseconds interval);
+
+    // Snapshot of the instrumentation of the logger (see stats)
+    struct Stats {
+      // Records and bytes written to the log files, per level (packed bytes for the deferred records of the binary files)
+      std::array<uint64_t, 4> records;
+      std::array<uint64_t, 4> bytes;
+      // Records dropped by the rate limits, per level
+      std::array<uint64_t, 4> suppressed;
+      // Records dropped by the async rings when full, per level
+      std::array<uint64_t, 4> dropped;
+      uint64_t rotations;
+      // Time the log files were locked to rotate them
+      std::chrono::nanoseconds rotationTime;
+      // Times a thread waited for the lock of a log file, and the time waited
+      uint64_t lockWaits;
+      std::chrono::nanoseconds lockWaitTime;
+      // Latency of the logging calls (from the timestamp of the record until it is written or queued): count, min, max, mean, p50, p99
+      uint64_t writes;
+      std::chrono::nanoseconds writeMin;
+      std::chrono::nanoseconds writeMax;
+      std::chrono::nanoseconds writeMean;
+      std::chrono::nanoseconds writeP50;
+      std::chrono::nanoseconds writeP99;
+    };
+
+    inline static Stats stats();
+
+    // Writes the stats to the PROFILING sink
+    inline static void dumpStats();
+
+    // Interval (0 to disable) of the periodic dump of the stats
+    inline static void setStatsInterval(std::chrono::milliseconds interval);
+
+    inline static void startTimer(std::string_view function, int line);
+
+    template <typename UNIT>
+    static void stopTimer(std::string_view unit, std::string_view function, int line);
+
+    inline static void addTimerSample(std::string_view name, std::chrono::nanoseconds duration);
+
+    // Writes count, min, max, mean, p50 and p99 of each named timer to the PROFILING sink
+    inline static void dumpTimerStats(bool reset = false);
+
+    // Interval (0 to disable) of the periodic dump of the timer statistics
+    inline static void setTimerStatsInterval(std::chrono::milliseconds interval);
+
+    static void setLevel(LogLevel level);
+
+    inline static bool isEnabled(LogLevel level);
+
+    // Use the macros logDebugF, logInfoF, logErrorF, which check the format string at compile time
+    template <typename FORMAT, typename... ARGS>
+    static void writeFormatted(LogLevel level, FORMAT, std::string_view format, const ARGS&... args);
+
+    // Use the macros logDebugKV, logInfoKV, logErrorKV: a message followed by key/value pairs, written as
+    // key=value in the text files and as fields of the record in the JSON files
+    template <typename... FIELDS>
+    static void writeFields(LogLevel level, std::string_view message, const FIELDS&... fields);
+
+    static void setLogFile(LogLevel level, const std::string& fileName, Policy policy, uint8_t maxNumFiles = 0, uintmax_t maxSize = 0, Format format = Format::TEXT);
+       
+    static void setLogFile(const std::string& fileName, Policy policy, uint8_t maxNumFiles = 0, uintmax_t maxSize = 0, Format format = Format::TEXT);       
+
+    // Converts a binary log file into text. Returns false if the file is not a valid binary log file or it is truncated
+    inline static bool decodeBinaryLog(std::istream& in, std::ostream& out);
+
+    inline static void setDateTimeFormat(const std::string& format);
+
+    // Single line mode: the ends of line of the text records are written as \n and \r, and the ERROR header is "*** ERROR! "
+    inline static void setSingleLine(bool enabled);
+
+    // Elements of the layouts of the text records (see setLayout). Each one gives the maximum length it writes and writes it in place
+    // Local time in the format of setDateTimeFormat, followed by the fraction of the second in UNIT (none for seconds)
+    template <typename UNIT = std::chrono::milliseconds>
+    struct Time {
+      static_assert(UNIT::period::num == 1 && (UNIT::period::den == 1 || UNIT::period::den == 1000 || UNIT::period::den == 1000000 ||
+        UNIT::period::den == 1000000000), "The unit of the time must be seconds, milliseconds, microseconds or nanoseconds");
+      static constexpr unsigned DIGITS{ UNIT::period::den == 1 ? 0u : UNIT::period::den == 1000 ? 3u : UNIT::period::den == 1000000 ? 6u : 9u };
+      static constexpr unsigned FIELDS{ LAYOUT_TIME };
+
+      static size_t length(const Record&, std::string_view timestamp) { return timestamp.size() + 1 + DIGITS; }
+
+      static char* write(char* p, const Record& record, std::string_view timestamp) {
+        p = std::copy(timestamp.begin(), timestamp.end(), p);
+        if constexpr (DIGITS > 0) {
+          *p++ = '.';
+          auto fraction{ static_cast<uint64_t>(std::chrono::duration_cast<UNIT>(record.time - std::chrono::floor<std::chrono::seconds>(record.time)).count()) };
+          for (auto digit{ p + DIGITS }; digit != p; fraction /= 10) *--digit = static_cast<char>('0' + fraction % 10);
+          p += DIGITS;
+        }
+        return p;
+      }
+    };
+
+    // Literal text: a reference to a constexpr array of characters, e.g. static constexpr char separator[]{ " - " }; ... Lit<separator>
+    template <const auto& TEXT>
+    struct Lit {
+      static constexpr std::string_view VALUE{ TEXT, sizeof(TEXT) - 1 };
+      static constexpr unsigned FIELDS{ 0 };
+
+      static constexpr size_t length(const Record&, std::string_view) { return VALUE.size(); }
+
+      static char* write(char* p, const Record&, std::string_view) { return std::copy(VALUE.begin(), VALUE.end(), p); }
+    };
+
+    // Name of the level: DEBUG, INFO, ERROR
+    struct Level {
+      static constexpr unsigned FIELDS{ 0 };
+
+      static size_t length(const Record& record, std::string_view) { return _LEVEL_NAMES[record.level].size(); }
+
+      static char* write(char* p, const Record& record, std::string_view) { return std::copy(_LEVEL_NAMES[record.level].begin(), _LEVEL_NAMES[record.level].end(), p); }
+    };
+
+    // Header of the default layout: "DEBUG: ", "INFO: ", "*** ERROR!" followed by a new line (a space in the single line mode)
+    struct Header {
+      static constexpr unsigned FIELDS{ 0 };
+
+      static size_t length(const Record& record, std::string_view) { return _header(record.level).size(); }
+
+      static char* write(char* p, const Record& record, std::string_view) {
+        auto& header{ _header(record.level) };
+        return std::copy(header.begin(), header.end(), p);
+      }
+    };
+
+    // Number of the thread logging the record (1, 2... in the order of their first record)
+    struct ThreadId {
+      static constexpr unsigned FIELDS{ LAYOUT_THREAD };
+
+      static constexpr size_t length(const Record&, std::string_view) { return 10; }
+
+      static char* write(char* p, const Record& record, std::string_view) { return std::to_chars(p, p + 10, record.thread).ptr; }
+    };
+
+    // Sequence number of the record, across all the levels (1, 2...)
+    struct Sequence {
+      static constexpr unsigned FIELDS{ LAYOUT_SEQUENCE };
+
+      static constexpr size_t length(const Record&, std::string_view) { return 20; }
+
+      static char* write(char* p, const Record& record, std::string_view) { return std::to_chars(p, p + 20, record.sequence).ptr; }
+    };
+
+    // file:line of the logging statement, without the directories ("?" if it was not logged through a macro)
+    struct Location {
+      static constexpr unsigned FIELDS{ LAYOUT_LOCATION };
+
+      static size_t length(const Record& record, std::string_view) { return record.site ? record.site->name.size() + 11 : 1; }
+
+      static char* write(char* p, const Record& record, std::string_view) {
+        if (!record.site) {
+          *p = '?';
+          return p + 1;
+        }
+        p = std::copy(record.site->name.begin(), record.site->name.end(), p);
+        *p = ':';
+        return std::to_chars(p + 1, p + 11, record.site->line).ptr;
+      }
+    };
+
+    // The message, which follows the header (optional, and only as the last element)
+    struct Msg {
+      static constexpr unsigned FIELDS{ 0 };
+
+      static constexpr size_t length(const Record&, std::string_view) { return 0; }
+
+      static char* write(char* p, const Record&, std::string_view) { return p; }
+    };
+
+    // Header of the text records, specialized at compile time: the lengths of the literals are constants, and the elements
+    // are written in place after a single resize of the record to their maximum length
+    template <typename... ELEMENTS>
+    struct Layout {
+      static_assert(_msgLast<ELEMENTS...>(), "Msg must be the last element of the layout");
+      static constexpr unsigned FIELDS{ (0u | ... | ELEMENTS::FIELDS) };
+
+      static void append(std::string& out, const Record& record) {
+        std::string_view timestamp;
+        if constexpr ((FIELDS & LAYOUT_TIME) != 0) timestamp = _timestampText(record.time);
+        auto size{ out.size() };
+        out.resize(size + (size_t{ 0 } + ... + ELEMENTS::length(record, timestamp)));
+        auto p{ out.data() + size };
+        ((p = ELEMENTS::write(p, record, timestamp)), ...);
+        out.resize(static_cast<size_t>(p - out.data()));
+      }
+    };
+
+    inline static constexpr char DEFAULT_SEPARATOR[]{ " - " };
+    using DefaultLayout = Layout<Time<>, Lit<DEFAULT_SEPARATOR>, Header, Msg>;
+
+    // Layout of the header of the text records (the JSON records keep their fields), e.g.:
+    //   static constexpr char before[]{ " [" }, after[]{ "] " };
+    //   Logger::setLayout<Logger::Layout<Logger::Time<std::chrono::microseconds>, Logger::Lit<before>, Logger::ThreadId, Logger::Lit<after>, Logger::Level, Logger::Msg>>();
+    // The records being logged while it is changed may still use the previous one. setLayout<DefaultLayout>() restores the default
+    template <typename LAYOUT>
+    static void setLayout() {
+      _layoutFields.store(LAYOUT::FIELDS, std::memory_order_relaxed);
+      _layout.store(std::is_same_v<LAYOUT, DefaultLayout> ? nullptr : &LAYOUT::append, std::memory_order_release);
+      _updateLimiting();
+    }
+
+    inline static void setFlushPolicy(LogLevel level, Flush policy, uint32_t value = 0);
+
+    // With several shards, the producer threads are spread over that many rings (capacity / shards records each), so that they
+    // do not contend on a single ring, and the writer merges them in timestamp order
+    inline static void setAsync(size_t capacity, Overflow overflow = Overflow::BLOCK, size_t shards = 1);
+
+    // Text log files set afterwards are written through memory mapped segments of segmentSize bytes (0 to disable).
+    // MAX_SIZE files use their maximum size as the segment. Ignored if the platform has no mmap
+    inline static void setMappedFiles(size_t segmentSize);
+
+    // Log files opened afterwards are written through io_uring (Linux, with ENABLE_LOG_IO_URING defined). Returns whether they will be:
+    // without the macro, or if the kernel does not allow io_uring, they are written as regular files
+    inline static bool setIoUring([[maybe_unused]] bool enable);
+
+    // Limits of the batches written at once by the async writers: records, bytes, and time waited for more records after the first one
+    inline static void setBatching(size_t maxRecords, size_t maxBytes, std::chrono::microseconds maxDelay = std::chrono::microseconds::zero());
+
+    // Codec compressing the rotated files in the background, with its level (0 for the default of the codec).
+    // The codecs are only available with ENABLE_LOG_COMPRESSION defined and zlib (GZIP) or zstd (ZSTD) installed
+    inline static void setCompression(Compression codec, int level = 0);
+
+    inline static void flush();
+
+    // Optional: on SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT or std::terminate, writes the records still pending in the async rings and in the
+    // buffers of the log files, and a final marker record, then re-raises the signal to the previous handler
+    inline static void installCrashHandler();
+
+    // Adds a sink to the records of a level (e.g. to write the errors both to a file and to std::cerr), or of all the levels.
+    // Like setLogFile(), it can be called while other threads are logging
+    inline static void addSink(LogLevel level, std::shared_ptr<Sink> sink);
+    inline static void addSink(std::shared_ptr<Sink> sink);
+
+    inline static void removeSinks();
+
+    // Rotates the log files with a MAX_SIZE or MAX_RECORDS policy, reopens the other ones (e.g. after logrotate moved them),
+    // and calls rotate() on the added sinks
+    inline static void rotate();
+
+    inline static void debug(std::string_view trace);
+    inline static void info(std::string_view trace);
+    inline static void error(std::string_view trace);
+
+    inline static RecordStream getDebugStream();
+    inline static RecordStream getInfoStream();
+    inline static RecordStream getErrorStream();
+
+  }; // END CLASS LOGGER
+
+
+  //  LOGGER: Private Methods 
+  //*************************************
+  void Logger::_asyncWriterThread(LogSink& sink, AsyncWriter& async) {
+    std::vector<Record> batch;
+    while (true) {
+      while (auto count{ _fillBatch(async, batch) }) {
+        async.freed();
+        TablePin pin;
+        bool fanOut{ false };
+        for (size_t i = 0; i < count; ++i) {
+          if (pin.table->outputs[batch[i].level].empty()) continue;
+          fanOut = true;
+          if (batch[i].format) _renderRecord(batch[i]);
+        }
+        {
+          auto lock{ _lockSink(sink) };
+          bool flush{ false };
+          // The records of the batch stay in place until they are written together
+          sink.batching = true;
+          for (size_t i = 0; i < count; ++i) {
+            _writeRecord(sink, batch[i]);
+            flush |= _flushDue(sink, batch[i].level);
+          }
+          sink.batching = false;
+          sink.submit();
+          if (flush) sink.flush();
+        }
+        if (fanOut) _fanOut(batch.data(), count);
+        for (size_t i = 0; i < count; ++i) batch[i].data.clear();
+        async.drained.fetch_add(count);
+      }
+
+      std::unique_lock<std::mutex> lock(async.wm);
+      async.drainedCv.notify_all();
+      if (async.pushed() > async.drained.load()) continue;
+      if (async.stop) break;
+      async.sleeping.store(true);
+      if (async.pushed() <= async.drained.load()) async.wakeCv.wait(lock);
+      async.sleeping.store(false);
+    }
+  }
+
+  size_t Logger::_fillBatch(AsyncWriter& async, std::vector<Record>& batch) {
+    auto maxRecords{ std::max<size_t>(_batchRecords.load(std::memory_order_relaxed), 1) };
+    auto maxBytes{ _batchBytes.load(std::memory_order_relaxed) };
+    auto delay{ std::chrono::microseconds(_batchDelay.load(std::memory_order_relaxed)) };
+    if (batch.size() < maxRecords) batch.resize(maxRecords);
+    size_t count{ 0 };
+    size_t bytes{ 0 };
+    auto deadline{ std::chrono::steady_clock::now() };
+    auto& shards{ async.shards };
+    auto& order{ async.order };
+    auto later{ [&async](size_t a, size_t b) { return async.heads[b].time < async.heads[a].time; } };
+    bool polled{ false };
+    while (count < maxRecords && bytes < maxBytes) {
+      bool popped;
+      if (shards.size() == 1)
+        popped = shards[0]->ring.tryPop(batch[count]);
+      else {
+        // k-way merge of the heads of the shards. The shards without a staged head are polled at each batch and when the heap is empty,
+        // and the shard of the record taken is the only one popped again: an idle shard costs nothing per record
+        if (!polled || order.empty()) {
+          for (size_t i = 0; i < shards.size(); ++i) {
+            if (!async.staged[i] && (async.staged[i] = shards[i]->ring.tryPop(async.heads[i]))) {
+              order.push_back(i);
+              std::push_heap(order.begin(), order.end(), later);
+            }
+          }
+          polled = true;
+        }
+        popped = !order.empty();
+        if (popped) {
+          std::pop_heap(order.begin(), order.end(), later);
+          auto next{ order.back() };
+          batch[count].swap(async.heads[next]);
+          if (shards[next]->ring.tryPop(async.heads[next]))
+            std::push_heap(order.begin(), order.end(), later);
+          else {
+            order.pop_back();
+            async.staged[next] = false;
+          }
+        }
+      }
+      if (popped) {
+        if (!count) deadline = std::chrono::steady_clock::now() + delay;
+        bytes += batch[count++].data.size();
+      }
+      else if (!count || !delay.count() || std::chrono::steady_clock::now() >= deadline)
+        break;
+      else {
+        // Waits for more records, up to the deadline of the first one: the producers blocked on the full ring can push them
+        async.freed();
+        std::unique_lock<std::mutex> lock(async.wm);
+        if (async.stop) break;
+        async.sleeping.store(true);
+        if (async.pushed() <= async.drained.load() + count) async.wakeCv.wait_until(lock, deadline);
+        async.sleeping.store(false);
+      }
+    }
+    return count;
+  }
+
+  template <typename FUNC>
+  void Logger::_forEachSink(FUNC func) {
+    TablePin pin;
+    _forEachSink(*pin.table, func);
+  }
+
+  template <typename FUNC>
+  void Logger::_forEachSink(const SinkTable& table, FUNC func) {
+    auto& sinks{ table.sinks };
+    for (auto it = sinks.begin(); it != sinks.end(); ++it) {
+      // Sinks shared by several levels are visited only once
+      if (std::find(sinks.begin(), it, *it) == it) func(**it);
+    }
+  }
+
+  void Logger::_commit(LogSink& sink, Record& record) {
+    if (auto capacity{ _flightRecords.load(std::memory_order_relaxed) }; LOGGER_UNLIKELY(capacity != 0) && (record.level == DEBUG || record.level == ERROR)) {
+      if (auto recorder{ _flightRecorder() }) {
+        if (record.level == DEBUG) {
+          recorder->push(record, capacity);
+          return;
+        }
+        thread_local std::vector<Record> recent;
+        recent.clear();
+        recorder->take(recent);
+        // Formatted for the ERROR sink
+        for (auto& debug : recent) _commitRecord(sink, debug);
+      }
+    }
+    _commitRecord(sink, record);
+  }
+
+  void Logger::_commitRecord(LogSink& sink, Record& record) {
+    auto& stats{ _stats() };
+    if (auto async{ sink.async.load() }) {
+      // The record is swapped with the slot of the ring
+      auto time{ record.time };
+      async->push(record);
+      stats.addLatency(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now() - time).count());
+      return;
+    }
+    // The callers pin the table, this one is nested
+    TablePin pin;
+    auto fanOut{ !pin.table->outputs[record.level].empty() };
+    if (fanOut && record.format) _renderRecord(record);
+    if (sink.mapped && !sink.maxRecords && !record.format) {
+      if (LOGGER_UNLIKELY(sink.dailyRotationDue(record.time))) {
+        auto lock{ _lockSink(sink) };
+        if (sink.dailyRotationDue(record.time)) _dailyRotation(sink, std::chrono::system_clock::to_time_t(record.time));
+      }
+      // No lock, the writers only reserve their bytes in the mapped segment
+      _writeMapped(sink, record.data, false);
+      stats.add(stats.records[record.level], 1);
+      stats.add(stats.bytes[record.level], record.data.size());
+    }
+    else {
+      auto lock{ _lockSink(sink) };
+      _writeRecord(sink, record);
+      if (_flushDue(sink, record.level)) sink.flush();
+    }
+    if (fanOut) _fanOut(&record, 1);
+    stats.addLatency(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now() - record.time).count());
+  }
+
+  std::unique_lock<std::mutex> Logger::_lockSink(LogSink& sink) {
+    std::unique_lock<std::mutex> lock(sink.lsm, std::try_to_lock);
+    if (!lock) {
+      auto start{ std::chrono::steady_clock::now() };
+      lock.lock();
+      auto& stats{ _stats() };
+      stats.add(stats.lockWaits, 1);
+      stats.add(stats.lockWaitTime, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+    return lock;
+  }
+
+  void Logger::_renderRecord(Record& record) {
+    thread_local std::string text;
+    text.clear();
+    _appendHeader(text, record, Format::TEXT);
+    auto message{ text.size() };
+    _renderDeferred(text, record.format->format, record.format->signature, record.data);
+    _appendFooter(text, message, Format::TEXT);
+    record.data.swap(text);
+    record.format = nullptr;
+  }
+
+  void Logger::_fanOut(Record* records, size_t count) {
+    // The records logged by a sink are fanned out while the outer call still uses its vectors
+    thread_local std::vector<Sink*> outerTargets;
+    thread_local std::vector<RecordView> outerViews;
+    std::vector<Sink*> nestedTargets;
+    std::vector<RecordView> nestedViews;
+    bool nested{ !_callingSinks.empty() };
+    auto& targets{ nested ? nestedTargets : outerTargets };
+    auto& views{ nested ? nestedViews : outerViews };
+    TablePin pin;
+    auto& table{ *pin.table };
+    targets.clear();
+    for (size_t i = 0; i < count; ++i) {
+      for (auto& output : table.outputs[records[i].level]) {
+        // A sink logging about itself would wait for its own lock: the record is dropped for it
+        if (std::find(targets.begin(), targets.end(), output.get()) == targets.end() && !SinkCall::active(output.get())) targets.push_back(output.get());
+      }
+    }
+    for (auto target : targets) {
+      views.clear();
+      for (size_t i = 0; i < count; ++i) {
+        auto& outputs{ table.outputs[records[i].level] };
+        if (std::find_if(outputs.begin(), outputs.end(), [target](auto& output) { return output.get() == target; }) != outputs.end())
+          views.push_back(RecordView{ records[i].level, records[i].time, records[i].data });
+      }
+      SinkCall call(*target);
+      std::lock_guard<std::mutex> lock(target->_sm);
+      target->write(views.data(), views.size());
+    }
+  }
+
+  template <typename FUNC>
+  void Logger::_forEachOutput(FUNC func) {
+    std::vector<Sink*> visited;
+    TablePin pin;
+    for (auto& outputs : pin.table->outputs) {
+      for (auto& output : outputs) {
+        if (std::find(visited.begin(), visited.end(), output.get()) != visited.end() || SinkCall::active(output.get())) continue;
+        visited.push_back(output.get());
+        SinkCall call(*output);
+        std::lock_guard<std::mutex> lock(output->_sm);
+        func(*output);
+      }
+    }
+  }
+
+  void Logger::_writeMapped(LogSink& sink, std::string_view data, bool locked) {
+    while (auto full{ sink.mapped->append(data) }) {
+      std::unique_lock<std::mutex> lock(sink.lsm, std::defer_lock);
+      if (!locked) lock.lock();
+      // Only the first writer finding the segment full moves to the next one, the others just retry
+      if (sink.mapped->generation() == full) {
+        if (sink.maxSize)
+          _sizeRotation(sink, data.size());
+        else
+          sink.mapped->extend(data.size());
+        // The file could not be opened again: the record is lost
+        if (sink.mapped->generation() == full) return;
+      }
+    }
+  }
+
+  void Logger::_writeRecord(LogSink& sink, const Record& record) {
+    if (LOGGER_UNLIKELY(sink.dailyRotationDue(record.time))) _dailyRotation(sink, std::chrono::system_clock::to_time_t(record.time));
+    if (sink.rotationDue()) _sizeRotation(sink);
+    auto& stats{ _stats() };
+    stats.add(stats.records[record.level], 1);
+    if (sink.format == Format::BINARY) {
+      _writeBinary(sink, record);
+      stats.add(stats.bytes[record.level], record.data.size());
+    }
+    else if (record.format) {
+      // Deferred record: rendered here, out of the hot path of the producer
+      sink.scratch.clear();
+      _appendHeader(sink.scratch, record, Format::TEXT);
+      auto message{ sink.scratch.size() };
+      _renderDeferred(sink.scratch, record.format->format, record.format->signature, record.data);
+      _appendFooter(sink.scratch, message, Format::TEXT);
+      sink.write(sink.scratch);
+      stats.add(stats.bytes[record.level], sink.scratch.size());
+    }
+    else {
+      sink.write(record.data, false);
+      stats.add(stats.bytes[record.level], record.data.size());
+    }
+  }
+
+  void Logger::_appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  void Logger::_writeBinarySegment(LogSink& sink) {
+    // The format identifiers and the time base are restarted in each segment
+    sink.formatIds.clear();
+    sink.lastTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    const uint16_t endianness{ 1 };
+    sink.scratch.assign("SLOGB");
+    sink.scratch.push_back(static_cast<char>(_BINARY_VERSION));
+    sink.scratch.push_back(*reinterpret_cast<const char*>(&endianness));
+    _appendVarint(sink.scratch, static_cast<uint64_t>(sink.lastTime));
+    sink.put(sink.scratch);
+  }
+
+  void Logger::_writeBinary(LogSink& sink, const Record& record) {
+    sink.scratch.clear();
+    if (!record.format) {
+      sink.scratch.push_back('T');
+      _appendVarint(sink.scratch, record.data.size());
+      sink.scratch.append(record.data);
+      sink.write(sink.scratch);
+      return;
+    }
+
+    auto id{ sink.formatIds.find(record.format) };
+    if (id == sink.formatIds.end()) {
+      id = sink.formatIds.emplace(record.format, sink.formatIds.size()).first;
+      sink.scratch.push_back('F');
+      _appendVarint(sink.scratch, id->second);
+      _appendVarint(sink.scratch, record.format->format.size());
+      sink.scratch.append(record.format->format);
+      _appendVarint(sink.scratch, record.format->signature.size());
+      sink.scratch.append(record.format->signature);
+    }
+
+    auto time{ std::chrono::duration_cast<std::chrono::microseconds>(record.time.time_since_epoch()).count() };
+    auto delta{ static_cast<int64_t>(time - sink.lastTime) };
+    sink.lastTime = time;
+    sink.scratch.push_back('R');
+    _appendVarint(sink.scratch, id->second);
+    sink.scratch.push_back(static_cast<char>(record.level));
+    _appendVarint(sink.scratch, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+    _appendVarint(sink.scratch, record.data.size());
+    sink.scratch.append(record.data);
+    sink.write(sink.scratch);
+  }
+
+  bool Logger::_flushDue(LogSink& sink, LogLevel level) {
+    switch (_flushPolicies[level].policy.load(std::memory_order_relaxed)) {
+    case Flush::IMMEDIATE:
+      sink.unflushedRecords = 0;
+      return true;
+    case Flush::RECORDS:
+      if (++sink.unflushedRecords >= _flushPolicies[level].value.load(std::memory_order_relaxed)) {
+        sink.unflushedRecords = 0;
+        return true;
+      }
+      return false;
+    default:
+      // NEVER: left to the stream buffer and the OS, INTERVAL: flushed by the scheduler
+      return false;
+    }
+  }
+
+  void Logger::_schedulerThread() {
+    auto& scheduler{ _scheduler };
+    std::unique_lock<std::mutex> lock(scheduler.sm);
+    while (!scheduler.stop) {
+      // The slots of the ticks elapsed since the last pass, a whole turn at most
+      auto now{ scheduler.now() };
+      auto last{ std::min(now, scheduler.tick + Scheduler::SLOTS) };
+      for (auto tick{ scheduler.tick + 1 }; tick <= last && !scheduler.stop; ++tick) {
+        auto& slot{ scheduler.wheel[tick % Scheduler::SLOTS] };
+        while (!scheduler.stop) {
+          auto timer{ std::find_if(slot.begin(), slot.end(), [now](const Scheduler::Timer& entry) { return entry.due <= now; }) };
+          if (timer == slot.end()) break;
+          auto key{ timer->key };
+          auto task{ std::move(timer->task) };
+          slot.erase(timer);
+          scheduler.due.erase(key);
+          scheduler.running = key;
+          scheduler.replaced = false;
+          lock.unlock();
+          auto delay{ task() };
+          lock.lock();
+          scheduler.running = nullptr;
+          if (delay.count() > 0 && !scheduler.replaced) scheduler.insert(key, delay, std::move(task));
+          scheduler.idleCv.notify_all();
+        }
+      }
+      scheduler.tick = now;
+
+      if (scheduler.due.empty())
+        scheduler.cv.wait(lock);
+      else {
+        auto next{ std::min_element(scheduler.due.begin(), scheduler.due.end(), [](auto& a, auto& b) { return a.second < b.second; })->second };
+        scheduler.cv.wait_until(lock, scheduler.start + next * Scheduler::TICK);
+      }
+    }
+  }
+
+  void Logger::_schedule(const void* key, std::chrono::milliseconds delay, std::function<std::chrono::milliseconds()> task) {
+    auto& scheduler{ _scheduler };
+    std::lock_guard<std::mutex> lock(scheduler.sm);
+    if (scheduler.stop) return;
+    scheduler.remove(key);
+    if (scheduler.running == key) scheduler.replaced = true;
+    scheduler.insert(key, delay, std::move(task));
+    if (!scheduler.thread.joinable()) scheduler.thread = std::thread(&Logger::_schedulerThread);
+    scheduler.cv.notify_one();
+  }
+
+  void Logger::_cancel(const void* key) {
+    auto& scheduler{ _scheduler };
+    std::unique_lock<std::mutex> lock(scheduler.sm);
+    scheduler.remove(key);
+    if (scheduler.running != key) return;
+    scheduler.replaced = true;
+    // A task cancelling its own timer does not wait for itself
+    if (std::this_thread::get_id() != scheduler.thread.get_id()) scheduler.idleCv.wait(lock, [&scheduler, key]() { return scheduler.running != key; });
+  }
+
+  void Logger::_scheduleSuppressionReport() {
+    _schedule(&_suppressionReportInterval, std::chrono::milliseconds(_suppressionReportInterval.load()), []() {
+      if (!_limiting.load()) return std::chrono::milliseconds(0);
+      _reportSuppressed();
+      return std::chrono::milliseconds(_suppressionReportInterval.load());
+    });
+  }
+
+  void Logger::_dailyRotation(LogSink& sink, std::time_t now) {
+    // An empty file is kept for the new day (a mapped file has its segment preallocated)
+    if (sink.bytesWritten || sink.mapped) {
+      _rotate(sink, 0, [target = sink.fileName + "." + sink.creationDate](const std::string& pending, const std::string& extension) {
+        std::filesystem::rename(pending + extension, target + extension);
+      });
+    }
+    std::stringstream strTM;
+    auto tm{ _localTime(now) };
+    strTM << std::put_time(&tm, "%Y%m%d");
+    sink.creationDate = strTM.str();
+    sink.nextRotation = _nextMidnight(now);
+    // Also when rotated by a writer, the timer of the file is moved to the next midnight
+    _scheduleDailyRotation(sink);
+  }
+
+  void Logger::_scheduleDailyRotation(LogSink& sink) {
+    _schedule(&sink, sink.untilRotation(), [&sink]() {
+      {
+        std::lock_guard<std::mutex> lock(sink.lsm);
+        auto now{ std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) };
+        if (now >= sink.nextRotation.load()) _dailyRotation(sink, now);
+      }
+      return sink.untilRotation();
+    });
+  }
+
+  std::time_t Logger::_nextMidnight(std::time_t timestamp) {
+    auto tm{ _localTime(timestamp) };
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    ++tm.tm_mday;
+    // Normalized by mktime, which also finds the daylight saving time of that day
+    tm.tm_isdst = -1;
+    return std::mktime(&tm);
+  }
+
+  void Logger::_publish(std::unique_ptr<SinkTable> table) {
+    std::shared_ptr<SinkTable> old{ _current.table.exchange(table.release()) };
+    auto epoch{ _tableEpoch.fetch_add(1) + 1 };
+    _maintain([old, epoch]() mutable {
+      _waitUnpinned(epoch);
+      old.reset();
+    });
+  }
+
+  void Logger::_retireAsync(std::vector<std::pair<std::shared_ptr<LogSink>, std::unique_ptr<AsyncWriter>>> writers) {
+    auto epoch{ _tableEpoch.fetch_add(1) + 1 };
+    auto retired{ std::make_shared<decltype(writers)>(std::move(writers)) };
+    _maintain([retired, epoch]() {
+      _waitUnpinned(epoch);
+      for (auto& [sink, writer] : *retired) {
+        if (!writer) continue;
+        // Drains its records, which may come after some records of the new writer
+        writer.reset();
+        std::lock_guard<std::mutex> lock(sink->lsm);
+        sink->flush();
+      }
+    });
+  }
+
+  void Logger::_waitUnpinned(uint64_t epoch) {
+    while (true) {
+      bool pinned{ _exitedPins.load() != 0 };
+      {
+        std::lock_guard<std::mutex> lock(_statsMutex);
+        for (auto stats : _threadStats) {
+          auto pin{ stats->pinned.load() };
+          pinned |= pin && pin < epoch;
+        }
+      }
+      if (!pinned) break;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  void Logger::_checkNotLogging(const char* function) {
+    if (_pinDepth) throw std::runtime_error(std::string("Logger::") + function + " cannot be called while logging (e.g. from a sink)");
+  }
+
+  std::unique_ptr<Logger::SinkTable> Logger::_copyTable() {
+    // Only replaced with _configMutex, which the caller holds
+    return std::make_unique<SinkTable>(*_current.table.load());
+  }
+
+  std::shared_ptr<Logger::LogSink> Logger::_openSink(const SinkTable& table, const std::string& fileName, Policy policy, uint8_t maxNumFiles, uintmax_t maxSize, Format format) {
+    std::shared_ptr<LogSink> sink;
+    for (auto& levelSink : table.sinks) {
+      if (levelSink->fileName == fileName) sink = levelSink;
+    }
+    bool replaced{ false };
+    if (!sink) {
+      std::unique_lock<std::mutex> lock(_fileSinksMutex);
+      // A sink being destroyed may still write the end of its file
+      _fileSinksCv.wait(lock, [&fileName, &sink]() {
+        auto entry{ std::find_if(_fileSinks.begin(), _fileSinks.end(), [&fileName](auto& entry) { return entry.first == fileName; }) };
+        return entry == _fileSinks.end() || (sink = entry->second.lock());
+      });
+      replaced = sink != nullptr;
+    }
+    if (sink) {
+      // Its writer may be older than the last setAsync
+      if (replaced) {
+        std::vector<std::pair<std::shared_ptr<LogSink>, std::unique_ptr<AsyncWriter>>> previous;
+        previous.emplace_back(sink, sink->replaceAsync(_asyncCapacity, _asyncOverflow, _asyncShards));
+        _retireAsync(std::move(previous));
+      }
+      return sink;
+    }
+    sink.reset(new LogSink(fileName, policy, maxNumFiles, maxSize, format), [](LogSink* fileSink) {
+      auto name{ fileSink->fileName };
+      delete fileSink;
+      std::lock_guard<std::mutex> lock(_fileSinksMutex);
+      auto entry{ std::find_if(_fileSinks.begin(), _fileSinks.end(), [&name](auto& entry) { return entry.first == name; }) };
+      if (entry != _fileSinks.end()) _fileSinks.erase(entry);
+      _fileSinksCv.notify_all();
+    });
+    {
+      std::lock_guard<std::mutex> lock(_fileSinksMutex);
+      _fileSinks.emplace_back(fileName, sink);
+    }
+    // Not published yet: there is no previous writer
+    if (_asyncCapacity) sink->replaceAsync(_asyncCapacity, _asyncOverflow, _asyncShards);
+    return sink;
+  }
+
+  void Logger::_onCrashSignal(int signal) {
+    size_t index{ 0 };
+    while (_CRASH_SIGNALS[index] != signal) ++index;
+    _crash(_CRASH_SIGNAL_NAMES[index]);
+#ifdef LOGGER_HAS_SIGACTION
+    sigaction(signal, &_previousActions[index], nullptr);
+#else
+    std::signal(signal, _previousHandlers[index] ? _previousHandlers[index] : SIG_DFL);
+#endif
+    // Blocked until the handler returns, then delivered to the previous handler or to the default action
+    std::raise(signal);
+  }
+
+  void Logger::_onTerminate() {
+    std::string reason{ "std::terminate" };
+    if (auto exception{ std::current_exception() }) {
+      try {
+        std::rethrow_exception(exception);
+      }
+      catch (const std::exception& e) {
+        reason.append(": ").append(e.what());
+      }
+      catch (...) {}
+    }
+    _crash(reason);
+    if (_previousTerminate) _previousTerminate();
+    std::abort();
+  }
+
+  void Logger::_crash(std::string_view reason) {
+    if (!_crashing.exchange(true)) {
+      _drainOnCrash(reason);
+      _crashDrained = true;
+      return;
+    }
+    // Bounded: the drain itself may have crashed
+    auto deadline{ std::chrono::steady_clock::now() + std::chrono::seconds(1) };
+    while (!_crashDrained.load() && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+  }
+
+  void Logger::_drainOnCrash(std::string_view reason) {
+    auto& text{ _crashText };
+    // No pin: the thread may have no statistics yet, and the table is not released in a crash
+    _forEachSink(*_current.table.load(), [&](LogSink& sink) {
+      // The lock may be held forever by the crashed thread: the records are written anyway after a while
+      bool locked{ false };
+      for (int attempt = 0; attempt < 10000 && !(locked = sink.lsm.try_lock()); ++attempt) std::this_thread::yield();
+      uint64_t written{ 0 };
+      uint64_t lost{ 0 };
+      if (auto async{ sink.async.load() }) {
+        // The batch already taken by the writer thread is written by it, if the process lives long enough (after the marker)
+        for (auto& shard : async->shards) {
+          auto& record{ *_crashRecord };
+          while (shard->ring.tryPop(record)) {
+            if (!record.format) {
+              _crashWrite(sink, record.data);
+              ++written;
+              continue;
+            }
+            // Rendered within the reserved capacity (a number takes at most 24 characters for its 8 bytes)
+            if (record.format->format.size() + 5 * record.data.size() + 256 > text.capacity()) {
+              ++lost;
+              continue;
+            }
+            text.clear();
+            _appendCrashHeader(text, record.level, record.time, Format::TEXT);
+            _renderDeferred(text, record.format->format, record.format->signature, record.data);
+            text.push_back('\n');
+            _crashWrite(sink, text);
+            ++written;
+          }
+        }
+      }
+      text.clear();
+      auto format{ sink.format == Format::JSON ? Format::JSON : Format::TEXT };
+      _appendCrashHeader(text, ERROR, std::chrono::system_clock::now(), format);
+      auto message{ text.size() };
+      text.append("*** CRASH (").append(reason.substr(0, text.capacity() / 2)).append("): ");
+      _appendValue(text, written);
+      text.append(" pending records written by the crash handler");
+      if (lost) {
+        text.append(", ");
+        _appendValue(text, lost);
+        text.append(" lost");
+      }
+      // Without special characters, unless it is the message of an exception (std::terminate is not a signal handler)
+      _appendFooter(text, message, format);
+      _crashWrite(sink, text);
+      if (locked) sink.lsm.unlock();
+    });
+  }
+
+  void Logger::_crashWrite(LogSink& sink, std::string_view data) {
+    auto put{ [&sink](std::string_view piece) {
+      if (sink.mapped)
+        // Lost if the segment is full
+        sink.mapped->append(piece);
+      else if (sink.file)
+        sink.file->emergencyWrite(piece);
+      else {
+#ifdef LOGGER_HAS_SIGACTION
+        // What is buffered in the standard streams is not written
+        auto fd{ sink.stream == &std::cout ? STDOUT_FILENO : STDERR_FILENO };
+        while (!piece.empty()) {
+          auto written{ ::write(fd, piece.data(), piece.size()) };
+          if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+          }
+          piece.remove_prefix(static_cast<size_t>(written));
+        }
+#else
+        sink.stream->write(piece.data(), static_cast<std::streamsize>(piece.size()));
+        sink.stream->flush();
+#endif
+      }
+    } };
+    if (sink.format == Format::BINARY) {
+      // Text record of the binary format
+      char prefix[11]{ 'T' };
+      size_t length{ 1 };
+      auto size{ data.size() };
+      for (; size >= 0x80; size >>= 7) prefix[length++] = static_cast<char>((size & 0x7F) | 0x80);
+      prefix[length++] = static_cast<char>(size);
+      put(std::string_view(prefix, length));
+    }
+    put(data);
+  }
+
+  void Logger::_appendCrashHeader(std::string& out, LogLevel level, std::chrono::system_clock::time_point time, Format format) {
+#ifdef LOGGER_HAS_SIGACTION
+    // "%F %T" and the milliseconds, computed from the days since 1970-01-01 (H. Hinnant's civil_from_days)
+    auto milliseconds{ std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() + int64_t{ _crashUtcOffset } * 1000 };
+    auto seconds{ milliseconds / 1000 };
+    auto z{ seconds / 86400 + 719468 };
+    auto era{ z / 146097 };
+    auto dayOfEra{ z - era * 146097 };
+    auto yearOfEra{ (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365 };
+    auto dayOfYear{ dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100) };
+    auto monthIndex{ (5 * dayOfYear + 2) / 153 };
+    auto month{ monthIndex < 10 ? monthIndex + 3 : monthIndex - 9 };
+    char timestamp[]{ "0000-00-00 00:00:00.000" };
+    auto put{ [&timestamp](size_t at, int64_t value, size_t digits) {
+      for (size_t i = digits; i--; value /= 10) timestamp[at + i] = static_cast<char>('0' + value % 10);
+    } };
+    put(0, yearOfEra + era * 400 + (month <= 2), 4);
+    put(5, month, 2);
+    put(8, dayOfYear - (153 * monthIndex + 2) / 5 + 1, 2);
+    put(11, seconds % 86400 / 3600, 2);
+    put(14, seconds % 3600 / 60, 2);
+    put(17, seconds % 60, 2);
+    put(20, milliseconds % 1000, 3);
+    std::string_view text{ timestamp, sizeof(timestamp) - 1 };
+    if (format == Format::JSON)
+      out.append("{\"time\":\"").append(text).append("\",\"level\":\"").append(_LEVEL_NAMES[level]).append("\",\"message\":\"");
+    else
+      out.append(text).append(" - ").append(_header(level));
+#else
+    _appendHeader(out, level, time, format);
+#endif
+  }
+
+  bool Logger::_admit(LogLevel level, CallSiteState& state) {
+    thread_local std::array<uint32_t, 4> sampled{};
+    thread_local std::array<TokenBucket, 4> buckets;
+    auto oneInN{ _sampling[level].load(std::memory_order_relaxed) };
+    if (oneInN > 1 && sampled[level]++ % oneInN) return false;
+    auto now{ std::chrono::steady_clock::now() };
+    if (!buckets[level].take(_levelLimits[level], now)) {
+      _suppressed[level].fetch_add(1, std::memory_order_relaxed);
+      auto& stats{ _stats() };
+      stats.add(stats.suppressed[level], 1);
+      return false;
+    }
+    if (!state.bucket.take(_callSiteLimit, now)) {
+      state.site.suppressed.fetch_add(1, std::memory_order_relaxed);
+      auto& stats{ _stats() };
+      stats.add(stats.suppressed[level], 1);
+      return false;
+    }
+    if (_layoutFields.load(std::memory_order_relaxed) & LAYOUT_LOCATION) _callSite = &state.site;
+    return true;
+  }
+
+  void Logger::_reportSuppressed() {
+    for (uint8_t level = 0; level < _suppressed.size(); ++level) {
+      if (auto count{ _suppressed[level].exchange(0, std::memory_order_relaxed) }) {
+        _write(static_cast<LogLevel>(level), "Suppressed " + std::to_string(count) + " records (rate limit)");
+      }
+    }
+    std::vector<std::pair<LogLevel, std::string>> reports;
+    {
+      std::lock_guard<std::mutex> lock(_callSitesMutex);
+      for (auto site : _callSites) {
+        if (auto count{ site->suppressed.exchange(0, std::memory_order_relaxed) }) {
+          reports.emplace_back(site->level, "Suppressed " + std::to_string(count) + " records at " + site->file + ":" + std::to_string(site->line) + " (rate limit)");
+        }
+      }
+    }
+    for (auto& report : reports) _write(report.first, report.second);
+  }
+
+  void Logger::_updateLimiting() {
+    bool limiting{ _callSiteLimit.rate.load() != 0 };
+    for (size_t level = 0; level < _levelLimits.size(); ++level) {
+      limiting = limiting || _levelLimits[level].rate.load() || _sampling[level].load() > 1;
+    }
+    // The call sites are also given to the layout through admit()
+    _limiting = limiting || (_layoutFields.load() & LAYOUT_LOCATION);
+    if (limiting) _scheduleSuppressionReport();
+  }
+
+  Logger::ThreadStats& Logger::_stats() {
+    if (LOGGER_UNLIKELY(!_currentStats)) {
+      thread_local ThreadStatsHolder holder;
+      _currentStats = &holder.stats;
+    }
+    return *_currentStats;
+  }
+
+  Logger::FlightRecorder* Logger::_flightRecorder() {
+    if (LOGGER_UNLIKELY(!_currentRecorder) && !_recorderExited) {
+      thread_local FlightRecorderHolder holder;
+      _currentRecorder = &holder.recorder;
+    }
+    return _currentRecorder;
+  }
+
+  Logger::ThreadTimers& Logger::_timers() {
+    thread_local ThreadTimers timers;
+    return timers;
+  }
+
+  std::tm Logger::_localTime(std::time_t timestamp) {
+    std::tm tm{};
+#ifdef _WIN32
+    localtime_s(&tm, &timestamp);
+#else
+    localtime_r(&timestamp, &tm);
+#endif
+    return tm;
+  }
+
+  void Logger::_appendTimestamp(std::string& out, std::chrono::system_clock::time_point now) {
+    auto milliseconds{ static_cast<unsigned>(std::chrono::duration_cast<std::chrono::milliseconds>(now - std::chrono::floor<std::chrono::seconds>(now)).count()) };
+    const char digits[]{ '.', static_cast<char>('0' + milliseconds / 100), static_cast<char>('0' + milliseconds / 10 % 10), static_cast<char>('0' + milliseconds % 10) };
+    out.append(_timestampText(now)).append(digits, 4);
+  }
+
+  const std::string& Logger::_timestampText(std::chrono::system_clock::time_point now) {
+    // The formatted date and time are cached per thread for the current second, only the fraction is patched in
+    struct TimestampCache {
+      std::time_t second{ -1 };
+      uint32_t version{ 0 };
+      std::string text;
+    };
+    thread_local TimestampCache cache;
+
+    auto second{ std::chrono::floor<std::chrono::seconds>(now) };
+    auto timestamp{ std::chrono::system_clock::to_time_t(second) };
+    auto version{ _dateTimeFormatVersion.load(std::memory_order_acquire) };
+    if (timestamp != cache.second || version != cache.version) {
+      std::string format;
+      {
+        std::lock_guard<std::mutex> lock(_dateTimeFormatMutex);
+        format = _dateTimeFormat;
+      }
+      auto tm{ _localTime(timestamp) };
+      cache.text.resize(64 + 2 * format.size());
+      size_t length{ 0 };
+      while (!format.empty() && (length = std::strftime(cache.text.data(), cache.text.size(), format.c_str(), &tm)) == 0 && cache.text.size() < 4096)
+        cache.text.resize(cache.text.size() * 2);
+      cache.text.resize(length);
+      cache.second = timestamp;
+      cache.version = version;
+    }
+    return cache.text;
+  }
+
+  uint32_t Logger::_threadId() {
+    thread_local uint32_t id{ _nextThreadId.fetch_add(1, std::memory_order_relaxed) + 1 };
+    return id;
+  }
+
+  void Logger::_appendHeader(std::string& out, LogLevel level, std::chrono::system_clock::time_point time, Format format) {
+    if (format == Format::JSON) {
+      out.append("{\"time\":\"");
+      auto timestamp{ out.size() };
+      _appendTimestamp(out, time);
+      _escapeJson(out, timestamp);
+      out.append("\",\"level\":\"").append(_LEVEL_NAMES[level]).append("\",\"message\":\"");
+    }
+    else {
+      _appendTimestamp(out, time);
+      out.append(" - ").append(_header(level));
+    }
+  }
+
+  void Logger::_appendHeader(std::string& out, const Record& record, Format format) {
+    if (format != Format::JSON) {
+      if (auto layout{ _layout.load(std::memory_order_acquire) }) {
+        layout(out, record);
+        return;
+      }
+    }
+    _appendHeader(out, record.level, record.time, format);
+  }
+
+  void Logger::_appendFooter(std::string& out, size_t message, Format format) {
+    if (format == Format::JSON) {
+      _escapeJson(out, message);
+      out.append("\"}\n");
+    }
+    else {
+      if (_singleLine.load(std::memory_order_relaxed)) _escapeLines(out, message);
+      out.push_back('\n');
+    }
+  }
+
+  void Logger::_escapeJson(std::string& out, size_t from) {
+    // Usual case: nothing to escape, or only valid UTF-8 sequences
+    const char* end{ out.data() + out.size() };
+    auto first{ _findEscape<true>(out.data() + from, end) };
+    size_t length;
+    while (first != end && static_cast<unsigned char>(*first) >= 0x80 && (length = _utf8Length(first, end)))
+      first = _findEscape<true>(first + length, end);
+    if (first == end) return;
+    thread_local std::string tail;
+    tail.assign(first, end);
+    out.erase(static_cast<size_t>(first - out.data()));
+    const char hex[]{ "0123456789abcdef" };
+    for (const char *p{ tail.data() }, *tailEnd{ p + tail.size() }; p != tailEnd;) {
+      auto next{ _findEscape<true>(p, tailEnd) };
+      out.append(p, static_cast<size_t>(next - p));
+      if ((p = next) == tailEnd) break;
+      auto c{ static_cast<unsigned char>(*p) };
+      switch (c) {
+      case '"': out.append("\\\""); break;
+      case '\\': out.append("\\\\"); break;
+      case '\n': out.append("\\n"); break;
+      case '\r': out.append("\\r"); break;
+      case '\t': out.append("\\t"); break;
+      default:
+        if (c < 0x20) {
+          out.append("\\u00").push_back(hex[c >> 4]);
+          out.push_back(hex[c & 0xF]);
+        }
+        else if ((length = _utf8Length(p, tailEnd))) {
+          out.append(p, length);
+          p += length - 1;
+        }
+        else
+          out.append("\\ufffd");
+      }
+      ++p;
+    }
+  }
+
+  void Logger::_escapeLines(std::string& out, size_t from) {
+    const char* end{ out.data() + out.size() };
+    auto first{ _findEscape<false>(out.data() + from, end) };
+    if (first == end) return;
+    thread_local std::string tail;
+    tail.assign(first, end);
+    out.erase(static_cast<size_t>(first - out.data()));
+    for (const char *p{ tail.data() }, *tailEnd{ p + tail.size() }; p != tailEnd; ++p) {
+      auto next{ _findEscape<false>(p, tailEnd) };
+      out.append(p, static_cast<size_t>(next - p));
+      if ((p = next) == tailEnd) break;
+      out.append(*p == '\n' ? "\\n" : "\\r");
+    }
+  }
+
+  template <bool JSON>
+  const char* Logger::_findEscape(const char* p, const char* end) {
+#ifdef LOGGER_HAS_AVX2
+    static const bool avx2{ __builtin_cpu_supports("avx2") != 0 };
+    if (avx2) return _findEscape32<JSON>(p, end);
+#endif
+    return _findEscape16<JSON>(p, end);
+  }
+
+#ifdef LOGGER_HAS_AVX2
+  template <bool JSON>
+  __attribute__((target("avx2"))) const char* Logger::_findEscape32(const char* p, const char* end) {
+    for (; end - p >= 32; p += 32) {
+      auto chunk{ _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)) };
+      __m256i found;
+      // Signed comparison: the bytes over 0x7F are also lower than 0x20
+      if constexpr (JSON)
+        found = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\\'))),
+          _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), chunk));
+      else
+        found = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\r')));
+      if (auto bits{ static_cast<uint32_t>(_mm256_movemask_epi8(found)) }) return p + _firstBit(bits);
+    }
+    return _findEscape16<JSON>(p, end);
+  }
+#endif
+
+  template <bool JSON>
+  const char* Logger::_findEscape16(const char* p, const char* end) {
+#if defined(LOGGER_HAS_SSE2)
+    for (; end - p >= 16; p += 16) {
+      auto chunk{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) };
+      __m128i found;
+      if constexpr (JSON)
+        found = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))),
+          _mm_cmplt_epi8(chunk, _mm_set1_epi8(0x20)));
+      else
+        found = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')));
+      if (auto bits{ static_cast<uint32_t>(_mm_movemask_epi8(found)) }) return p + _firstBit(bits);
+    }
+#elif defined(LOGGER_HAS_NEON)
+    for (; end - p >= 16; p += 16) {
+      auto chunk{ vld1q_u8(reinterpret_cast<const uint8_t*>(p)) };
+      uint8x16_t found;
+      // Out of [0x20, 0x7F]: c - 0x20 (modulo 256) >= 0x60
+      if constexpr (JSON)
+        found = vorrq_u8(vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('"')), vceqq_u8(chunk, vdupq_n_u8('\\'))),
+          vcgeq_u8(vsubq_u8(chunk, vdupq_n_u8(0x20)), vdupq_n_u8(0x60)));
+      else
+        found = vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('\n')), vceqq_u8(chunk, vdupq_n_u8('\r')));
+      // The position is found byte by byte
+      if (vmaxvq_u8(found)) break;
+    }
+#endif
+    for (; p != end; ++p) {
+      auto c{ static_cast<unsigned char>(*p) };
+      if constexpr (JSON) {
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x80) return p;
+      }
+      else if (c == '\n' || c == '\r')
+        return p;
+    }
+    return end;
+  }
+
+  size_t Logger::_utf8Length(const char* p, const char* end) {
+    auto lead{ static_cast<unsigned char>(*p) };
+    size_t length{ lead < 0x80 ? 1u : lead < 0xC2 ? 0u : lead < 0xE0 ? 2u : lead < 0xF0 ? 3u : lead < 0xF5 ? 4u : 0u };
+    if (length < 2 || static_cast<size_t>(end - p) < length) return length == 1 ? 1 : 0;
+    for (size_t i = 1; i < length; ++i) {
+      if ((static_cast<unsigned char>(p[i]) & 0xC0) != 0x80) return 0;
+    }
+    auto second{ static_cast<unsigned char>(p[1]) };
+    if ((lead == 0xE0 && second < 0xA0) || (lead == 0xED && second > 0x9F) || (lead == 0xF0 && second < 0x90) || (lead == 0xF4 && second > 0x8F))
+      return 0;
+    return length;
+  }
+
+#ifdef LOGGER_HAS_SSE2
+  unsigned Logger::_firstBit(uint32_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctz(bits));
+#else
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return static_cast<unsigned>(index);
+#endif
+  }
+#endif
+
+  template <typename T>
+  void Logger::_appendJsonValue(std::string& out, const T& value) {
+    if constexpr (std::is_same_v<T, bool>)
+      out.append(value ? "true" : "false");
+    else if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, char>) {
+      if constexpr (std::is_floating_point_v<T>) {
+        if (!std::isfinite(value)) {
+          out.append("null");
+          return;
+        }
+      }
+      _appendValue(out, value);
+    }
+    else {
+      out.push_back('"');
+      auto start{ out.size() };
+      _appendValue(out, value);
+      _escapeJson(out, start);
+      out.push_back('"');
+    }
+  }
+
+  template <typename KEY, typename VALUE, typename... FIELDS>
+  void Logger::_appendFields(std::string& out, bool json, const KEY& key, const VALUE& value, const FIELDS&... fields) {
+    static_assert(std::is_convertible_v<const KEY&, std::string_view>, "The keys of the fields must be strings");
+    if (json) {
+      out.append(",\"");
+      auto start{ out.size() };
+      out.append(std::string_view(key));
+      _escapeJson(out, start);
+      out.append("\":");
+      _appendJsonValue(out, value);
+    }
+    else {
+      // key=value, with the value quoted if needed (logfmt)
+      out.push_back(' ');
+      out.append(std::string_view(key)).push_back('=');
+      auto start{ out.size() };
+      _appendValue(out, value);
+      if constexpr (!std::is_arithmetic_v<VALUE>) {
+        if (start == out.size() || out.find_first_of(" =\"", start) != std::string::npos || std::any_of(out.begin() + start, out.end(), [](char c) { return static_cast<unsigned char>(c) < 0x20; })) {
+          _escapeJson(out, start);
+          out.insert(start, 1, '"');
+          out.push_back('"');
+        }
+      }
+    }
+    _appendFields(out, json, fields...);
+  }
+
+  void Logger::_write(LogLevel level, std::string_view trace) {
+    CallRecord call;
+    auto& record{ *call };
+    TablePin pin;
+    auto& sink{ _levelSink(*pin.table, level) };
+    record.reset(level);
+    _appendHeader(record.data, record, sink.format);
+    auto message{ record.data.size() };
+    record.data.append(trace);
+    _appendFooter(record.data, message, sink.format);
+    _commit(sink, record);
+  }
+
+  constexpr size_t Logger::_countPlaceholders(std::string_view format) {
+    size_t count{ 0 };
+    for (size_t i = 0; i < format.size(); ++i) {
+      if (format[i] == '{') {
+        if (i + 1 < format.size() && format[i + 1] == '{')
+          ++i;
+        else if (i + 1 < format.size() && format[i + 1] == '}') {
+          ++count;
+          ++i;
+        }
+        else
+          return SIZE_MAX;
+      }
+      else if (format[i] == '}') {
+        if (i + 1 < format.size() && format[i + 1] == '}')
+          ++i;
+        else
+          return SIZE_MAX;
+      }
+    }
+    return count;
+  }
+
+  std::string_view Logger::_appendLiteral(std::string& out, std::string_view format) {
+    // Appends the text up to the next placeholder, and returns the format after it
+    size_t i{ 0 };
+    while (i < format.size()) {
+      auto brace{ format.find_first_of("{}", i) };
+      if (brace == std::string_view::npos) break;
+      out.append(format.data() + i, brace - i + 1);
+      if (format[brace] == '{' && brace + 1 < format.size() && format[brace + 1] == '}') {
+        out.pop_back();
+        return format.substr(brace + 2);
+      }
+      // Escaped brace
+      i = brace + 2;
+    }
+    if (i < format.size()) out.append(format.data() + i, format.size() - i);
+    return {};
+  }
+
+  template <typename T>
+  std::string_view Logger::_stringView(const T& value) {
+    if constexpr (std::is_pointer_v<T>) {
+      if (!value) return "(null)";
+    }
+    return std::string_view(value);
+  }
+
+  template <typename T>
+  void Logger::_appendValue(std::string& out, const T& value) {
+    if constexpr (std::is_same_v<T, bool>)
+      out.append(value ? "true" : "false");
+    else if constexpr (std::is_same_v<T, char>)
+      out.push_back(value);
+    else if constexpr (std::is_arithmetic_v<T>) {
+      char digits[32];
+      auto result{ std::to_chars(digits, digits + sizeof(digits), value) };
+      out.append(digits, result.ptr);
+    }
+    else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+      out.append(_stringView(value));
+    else if constexpr (std::is_pointer_v<T>) {
+      char digits[20];
+      auto result{ std::to_chars(digits, digits + sizeof(digits), reinterpret_cast<uintptr_t>(value), 16) };
+      out.append("0x").append(digits, result.ptr);
+    }
+    else {
+      // Any other type is written with its operator<<, straight into the record
+      StringBuf strBuf{ out };
+      std::ostream stream{ &strBuf };
+      stream << value;
+    }
+  }
+
+  void Logger::_appendFormatted(std::string& out, std::string_view format) {
+    _appendLiteral(out, format);
+  }
+
+  template <typename T, typename... ARGS>
+  void Logger::_appendFormatted(std::string& out, std::string_view format, const T& value, const ARGS&... args) {
+    format = _appendLiteral(out, format);
+    _appendValue(out, value);
+    _appendFormatted(out, format, args...);
+  }
+
+  template <typename T>
+  constexpr char Logger::_typeCode() {
+    // '\0': the type cannot be deferred, the record is formatted by the caller
+    if constexpr (std::is_same_v<T, bool>)
+      return 'b';
+    else if constexpr (std::is_same_v<T, char>)
+      return 'c';
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+      return 'i';
+    else if constexpr (std::is_integral_v<T>)
+      return 'u';
+    else if constexpr (std::is_same_v<T, float>)
+      return 'f';
+    else if constexpr (std::is_floating_point_v<T>)
+      return 'd';
+    else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+      return 's';
+    else if constexpr (std::is_pointer_v<T>)
+      return 'p';
+    else
+      return '\0';
+  }
+
+  template <typename T>
+  void Logger::_packValue(std::string& out, const T& value) {
+    auto append{ [&out](const auto& raw) { out.append(reinterpret_cast<const char*>(&raw), sizeof(raw)); } };
+    constexpr char code{ _typeCode<T>() };
+    if constexpr (code == 'b' || code == 'c')
+      out.push_back(static_cast<char>(value));
+    else if constexpr (code == 'i')
+      append(static_cast<int64_t>(value));
+    else if constexpr (code == 'u')
+      append(static_cast<uint64_t>(value));
+    else if constexpr (code == 'f')
+      append(value);
+    else if constexpr (code == 'd')
+      append(static_cast<double>(value));
+    else if constexpr (code == 's') {
+      auto text{ _stringView(value) };
+      append(static_cast<uint32_t>(text.size()));
+      out.append(text);
+    }
+    else if constexpr (code == 'p')
+      append(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+  }
+
+  bool Logger::_renderDeferred(std::string& out, std::string_view format, std::string_view signature, std::string_view args) {
+    // Returns false if the arguments do not match the signature
+    auto read{ [&args](auto& raw) {
+      if (args.size() < sizeof(raw)) return false;
+      std::memcpy(&raw, args.data(), sizeof(raw));
+      args.remove_prefix(sizeof(raw));
+      return true;
+    } };
+
+    for (auto code : signature) {
+      format = _appendLiteral(out, format);
+      switch (code) {
+      case 'b': case 'c': {
+        char raw;
+        if (!read(raw)) return false;
+        if (code == 'b') _appendValue(out, raw != 0); else out.push_back(raw);
+        break;
+      }
+      case 'i': {
+        int64_t raw;
+        if (!read(raw)) return false;
+        _appendValue(out, raw);
+        break;
+      }
+      case 'u': case 'p': {
+        uint64_t raw;
+        if (!read(raw)) return false;
+        if (code == 'u') _appendValue(out, raw); else _appendValue(out, reinterpret_cast<const void*>(static_cast<uintptr_t>(raw)));
+        break;
+      }
+      case 'f': {
+        float raw;
+        if (!read(raw)) return false;
+        _appendValue(out, raw);
+        break;
+      }
+      case 'd': {
+        double raw;
+        if (!read(raw)) return false;
+        _appendValue(out, raw);
+        break;
+      }
+      case 's': {
+        uint32_t length;
+        if (!read(length) || args.size() < length) return false;
+        out.append(args.data(), length);
+        args.remove_prefix(length);
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+    _appendLiteral(out, format);
+    return true;
+  }
+
+  void Logger::_maintenanceThread(Maintenance& worker) {
+#ifdef __linux__
+    if (worker.idle) {
+      sched_param param{};
+      pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    }
+#endif
+    std::unique_lock<std::mutex> lock(worker.mm);
+    while (true) {
+      while (!worker.tasks.empty()) {
+        auto task{ std::move(worker.tasks.front()) };
+        worker.tasks.pop_front();
+        worker.busy = true;
+        lock.unlock();
+        try {
+          task();
+        }
+        catch (const std::exception& e) {
+          // Nobody to report to in this thread: the rotated file keeps its pending name
+          std::cerr << "Log file rotation failed: " << e.what() << std::endl;
+        }
+        lock.lock();
+        worker.busy = false;
+      }
+      worker.idleCv.notify_all();
+      if (worker.stop) break;
+      worker.cv.wait(lock);
+    }
+  }
+
+  void Logger::_maintain(std::function<void()> task, Maintenance& worker) {
+    std::lock_guard<std::mutex> lock(worker.mm);
+    worker.tasks.push_back(std::move(task));
+    if (!worker.thread.joinable()) worker.thread = std::thread(&Logger::_maintenanceThread, std::ref(worker));
+    worker.cv.notify_one();
+  }
+
+  template <typename FUNC>
+  void Logger::_rotate(LogSink& sink, size_t minCapacity, FUNC archive) {
+    // Only one rename is done with the lock of the sink: the rotated file gets a pending name and is archived by the maintenance thread
+    auto start{ std::chrono::steady_clock::now() };
+    auto pending{ sink.fileName + ".rotating." + std::to_string(_maintenance.sequence.fetch_add(1)) };
+    sink.close();
+    // A log call does not throw: the file is opened again whatever happened to it (e.g. removed or moved by another process)
+    std::error_code error;
+    std::filesystem::rename(sink.fileName, pending, error);
+    if (error) std::cerr << "Log file cannot be rotated: " << sink.fileName << ": " << error.message() << std::endl;
+    try {
+      sink.open(minCapacity);
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Log file cannot be opened again after its rotation: " << e.what() << std::endl;
+    }
+    if (error) return;
+    auto codec{ _compression.load() };
+    bool compressing;
+    {
+      std::lock_guard<std::mutex> lock(_compressor.mm);
+      compressing = _compressor.thread.joinable();
+    }
+    // Once a file has been compressed, the uncompressed ones go through the compression thread too, so that the archives stay in order
+    if (codec == Compression::NONE && !compressing)
+      _maintain([archive, pending]() { archive(pending, _EXTENSIONS[0]); });
+    else {
+      _maintain([archive, pending, codec, level = _compressionLevel.load()]() {
+        auto& extension{ _compress(pending, codec, level) };
+        _maintain([archive, pending, &extension]() { archive(pending, extension); });
+      }, _compressor);
+    }
+    _rotations.fetch_add(1, std::memory_order_relaxed);
+    _rotationTime.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+  }
+
+  void Logger::_sizeRotation(LogSink& sink, size_t minCapacity) {
+    _rotate(sink, minCapacity, [fileName = sink.fileName, maxNumFiles = sink.maxNumFiles](const std::string& pending, const std::string& compressed) {
+      // Compressed before shifting the files, so that the file being compressed is never renamed
+      // The tasks run in order, so the pending files of consecutive rotations are shifted in order too
+      // Each number holds a single archive: the one with another extension (left there before the compression was changed) is removed
+      auto moveTo = [&fileName](const std::string& file, int number, const std::string& extension) {
+        auto target{ fileName + "." + std::to_string(number) };
+        for (auto& other : _EXTENSIONS)
+          if (other != extension) std::filesystem::remove(target + other);
+        std::filesystem::rename(file, target + extension);
+      };
+      for (auto i = maxNumFiles - 2; i > 0; --i) {
+        for (auto& extension : _EXTENSIONS) {
+          // If file exists, rename
+          std::string file = fileName + "." + std::to_string(i) + extension;
+          if (std::filesystem::exists(file)) moveTo(file, i + 1, extension);
+        }
+      }
+      moveTo(pending + compressed, 1, compressed);
+    });
+    std::time_t timestamp{ std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) };
+    std::stringstream strTM;
+    auto tm{ _localTime(timestamp) };
+    strTM << std::put_time(&tm, "%Y%m%d");
+    sink.creationDate = strTM.str();
+  }
+
+  const std::string& Logger::_compress(const std::string& fileName, Compression codec, [[maybe_unused]] int level) {
+    if (codec == Compression::NONE) return _EXTENSIONS[0];
+
+    auto& extension{ _EXTENSIONS[static_cast<size_t>(codec)] };
+    auto target{ fileName + extension };
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in.is_open()) throw std::runtime_error("Log File cannot be opened: " + fileName);
+    std::vector<char> buffer(1 << 17);
+
+    switch (codec) {
+#ifdef LOGGER_HAS_GZIP
+    case Compression::GZIP: {
+      auto out{ gzopen(target.c_str(), ("wb" + std::to_string(level ? std::clamp(level, 1, 9) : 6)).c_str()) };
+      if (!out) throw std::runtime_error("Log File cannot be opened: " + target);
+      while (in.read(buffer.data(), buffer.size()) || in.gcount()) {
+        if (gzwrite(out, buffer.data(), static_cast<unsigned>(in.gcount())) <= 0) {
+          gzclose(out);
+          throw std::runtime_error("Log File cannot be compressed: " + fileName);
+        }
+      }
+      if (gzclose(out) != Z_OK) throw std::runtime_error("Log File cannot be compressed: " + fileName);
+      break;
+    }
+#endif
+#ifdef LOGGER_HAS_ZSTD
+    case Compression::ZSTD: {
+      std::ofstream out(target, std::ios::binary | std::ios::trunc);
+      if (!out.is_open()) throw std::runtime_error("Log File cannot be opened: " + target);
+      std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> context{ ZSTD_createCCtx(), ZSTD_freeCCtx };
+      ZSTD_CCtx_setParameter(context.get(), ZSTD_c_compressionLevel, level);
+      std::vector<char> output(ZSTD_CStreamOutSize());
+      ZSTD_EndDirective mode;
+      do {
+        in.read(buffer.data(), buffer.size());
+        mode = in.eof() ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input{ buffer.data(), static_cast<size_t>(in.gcount()), 0 };
+        bool finished;
+        do {
+          ZSTD_outBuffer chunk{ output.data(), output.size(), 0 };
+          auto remaining{ ZSTD_compressStream2(context.get(), &chunk, &input, mode) };
+          if (ZSTD_isError(remaining)) throw std::runtime_error("Log File cannot be compressed: " + fileName);
+          out.write(output.data(), static_cast<std::streamsize>(chunk.pos));
+          finished = mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size;
+        } while (!finished);
+      } while (mode != ZSTD_e_end);
+      if (!out.flush()) throw std::runtime_error("Log File cannot be compressed: " + fileName);
+      break;
+    }
+#endif
+    default:
+      throw std::runtime_error("Log compression codec not available in this build");
+    }
+
+    in.close();
+    std::filesystem::remove(fileName);
+    return extension;
+  }
+
+  Logger::LogFile* Logger::_openLogFile(const std::string& fileName, Format format) {
+    LogFile* logFile = new LogFile(fileName, format == Format::BINARY);
+    if (!logFile->is_open()) {
+      delete logFile;
+      throw std::runtime_error("Log File cannot be opened: " + fileName);
+    }
+    return logFile;
+  }
+
+
+  // LOGGER: Public methods definitions
+  //*************************************
+  void Logger::startTimer(std::string_view function, int line) {
+    auto& timers{ _timers() };
+    thread_local Record record;
+    record.reset(PROFILING);
+    _appendFormatted(record.data, "Timer #{} STARTED at {} (Line {})\n", timers.started.size() + 1, function, line);
+    TablePin pin;
+    _commit(*pin.table->sinks[PROFILING], record);
+    std::lock_guard<std::mutex> lock(timers.ttm);
+    timers.started.push_back(std::chrono::high_resolution_clock::now());
+  }
+
+  template <typename UNIT>
+  void Logger::stopTimer(std::string_view unit, std::string_view function, int line) {
+    auto stopTime{ std::chrono::high_resolution_clock::now() };
+    auto& timers{ _timers() };
+    thread_local Record record;
+    record.reset(PROFILING);
+    if (timers.started.size()) {
+      auto duration{ std::chrono::duration_cast<UNIT>(stopTime - timers.started.back()).count() };
+      _appendFormatted(record.data, "Timer #{} STOPPED at {} (Line {}) --- DURATION = {} {}\n", timers.started.size(), function, line, duration, unit);
+      std::lock_guard<std::mutex> lock(timers.ttm);
+      timers.started.pop_back();
+    }
+    else
+      record.data.append("Timer not started!\n");
+    TablePin pin;
+    _commit(*pin.table->sinks[PROFILING], record);
+  }
+
+  void Logger::addTimerSample(std::string_view name, std::chrono::nanoseconds duration) {
+    auto& timers{ _timers() };
+    // Only contended while the statistics are being dumped
+    std::lock_guard<std::mutex> lock(timers.ttm);
+    auto stats{ timers.stats.find(name) };
+    if (stats == timers.stats.end()) stats = timers.stats.emplace(std::string(name), TimerStats{}).first;
+    stats->second.add(duration.count());
+  }
+
+  void Logger::dumpTimerStats(bool reset) {
+    TimerStatsMap total;
+    {
+      std::lock_guard<std::mutex> lock(_timersMutex);
+      total = _retiredTimerStats;
+      if (reset) _retiredTimerStats.clear();
+      for (auto timers : _threadTimers) {
+        std::lock_guard<std::mutex> threadLock(timers->ttm);
+        for (auto& named : timers->stats) total[named.first].merge(named.second);
+        if (reset) timers->stats.clear();
+      }
+    }
+
+    Record record;
+    record.reset(PROFILING);
+    for (auto& named : total) {
+      auto& stats{ named.second };
+      _appendFormatted(record.data, "Timer stats {}: count = {}, min = {} ns, max = {} ns, mean = {} ns, p50 = {} ns, p99 = {} ns\n", named.first, stats.count,
+        stats.min, stats.max, static_cast<int64_t>(stats.sum / static_cast<double>(stats.count)), stats.percentile(0.5), stats.percentile(0.99));
+    }
+    TablePin pin;
+    if (!record.data.empty()) _commit(*pin.table->sinks[PROFILING], record);
+  }
+
+  void Logger::setTimerStatsInterval(std::chrono::milliseconds interval) {
+    _timerStatsInterval = static_cast<uint32_t>(interval.count());
+    if (!interval.count()) {
+      _cancel(&_timerStatsInterval);
+      return;
+    }
+    _schedule(&_timerStatsInterval, interval, []() {
+      auto next{ std::chrono::milliseconds(_timerStatsInterval.load()) };
+      if (next.count()) dumpTimerStats();
+      return next;
+    });
+  }
+
+  Logger::Stats Logger::stats() {
+    ThreadStats total;
+    {
+      std::lock_guard<std::mutex> lock(_statsMutex);
+      total.merge(_exitedStats);
+      for (auto threadStats : _threadStats) total.merge(*threadStats);
+    }
+    Stats stats{};
+    for (size_t level = 0; level < stats.records.size(); ++level) {
+      stats.records[level] = total.records[level].load();
+      stats.bytes[level] = total.bytes[level].load();
+      stats.suppressed[level] = total.suppressed[level].load();
+      stats.dropped[level] = total.dropped[level].load();
+    }
+    stats.rotations = _rotations.load();
+    stats.rotationTime = std::chrono::nanoseconds(_rotationTime.load());
+    stats.lockWaits = total.lockWaits.load();
+    stats.lockWaitTime = std::chrono::nanoseconds(total.lockWaitTime.load());
+
+    TimerStats latency;
+    latency.count = total.latencyCount.load();
+    if (latency.count) {
+      latency.min = total.latencyMin.load();
+      latency.max = total.latencyMax.load();
+      for (size_t i = 0; i < latency.histogram.size(); ++i) latency.histogram[i] = total.latency[i].load();
+      stats.writes = latency.count;
+      stats.writeMin = std::chrono::nanoseconds(latency.min);
+      stats.writeMax = std::chrono::nanoseconds(latency.max);
+      stats.writeMean = std::chrono::nanoseconds(total.latencySum.load() / latency.count);
+      stats.writeP50 = std::chrono::nanoseconds(latency.percentile(0.5));
+      stats.writeP99 = std::chrono::nanoseconds(latency.percentile(0.99));
+    }
+    return stats;
+  }
+
+  void Logger::dumpStats() {
+    auto snapshot{ stats() };
+    Record record;
+    record.reset(PROFILING);
+    _appendFormatted(record.data, "Logger stats: records = {}/{}/{}/{}, bytes = {}/{}/{}/{} (DEBUG/INFO/ERROR/PROFILING), suppressed = {}, dropped = {}\n",
+      snapshot.records[DEBUG], snapshot.records[INFO], snapshot.records[ERROR], snapshot.records[PROFILING],
+      snapshot.bytes[DEBUG], snapshot.bytes[INFO], snapshot.bytes[ERROR], snapshot.bytes[PROFILING],
+      snapshot.suppressed[DEBUG] + snapshot.suppressed[INFO] + snapshot.suppressed[ERROR] + snapshot.suppressed[PROFILING],
+      snapshot.dropped[DEBUG] + snapshot.dropped[INFO] + snapshot.dropped[ERROR] + snapshot.dropped[PROFILING]);
+    _appendFormatted(record.data, "Logger stats: rotations = {} ({} us), lock waits = {} ({} us), writes = {}: min = {} ns, max = {} ns, mean = {} ns, p50 = {} ns, p99 = {} ns\n",
+      snapshot.rotations, snapshot.rotationTime.count() / 1000, snapshot.lockWaits, snapshot.lockWaitTime.count() / 1000, snapshot.writes,
+      snapshot.writeMin.count(), snapshot.writeMax.count(), snapshot.writeMean.count(), snapshot.writeP50.count(), snapshot.writeP99.count());
+    TablePin pin;
+    _commit(*pin.table->sinks[PROFILING], record);
+  }
+
+  void Logger::setStatsInterval(std::chrono::milliseconds interval) {
+    _statsInterval = static_cast<uint32_t>(interval.count());
+    if (!interval.count()) {
+      _cancel(&_statsInterval);
+      return;
+    }
+    _schedule(&_statsInterval, interval, []() {
+      auto next{ std::chrono::milliseconds(_statsInterval.load()) };
+      if (next.count()) dumpStats();
+      return next;
+    });
+  }
+
+  void Logger::setRateLimit(LogLevel level, uint32_t recordsPerSecond, uint32_t burst) {
+    if (level >= _levelLimits.size()) throw std::runtime_error("Invalid log level");
+    _levelLimits[level].burst = burst;
+    _levelLimits[level].rate = recordsPerSecond;
+    _updateLimiting();
+  }
+
+  void Logger::setCallSiteRateLimit(uint32_t recordsPerSecond, uint32_t burst) {
+    _callSiteLimit.burst = burst;
+    _callSiteLimit.rate = recordsPerSecond;
+    _updateLimiting();
+  }
+
+  void Logger::setSampling(LogLevel level, uint32_t oneInN) {
+    if (level >= _sampling.size()) throw std::runtime_error("Invalid log level");
+    _sampling[level] = oneInN;
+    _updateLimiting();
+  }
+
+  void Logger::setFlightRecorder(size_t records) {
+    _flightRecords = records;
+    if (records) return;
+    std::vector<Record> discarded;
+    std::lock_guard<std::mutex> lock(_flightMutex);
+    for (auto recorder : _flightRecorders) recorder->take(discarded);
+  }
+
+  void Logger::dumpRecent() {
+    std::vector<Record> recent;
+    {
+      std::lock_guard<std::mutex> lock(_flightMutex);
+      for (auto recorder : _flightRecorders) recorder->take(recent);
+    }
+    std::stable_sort(recent.begin(), recent.end(), [](const Record& a, const Record& b) { return a.time < b.time; });
+    TablePin pin;
+    auto& sink{ *pin.table->sinks[ERROR] };
+    for (auto& record : recent) _commitRecord(sink, record);
+  }
+
+  void Logger::setSuppressionReportInterval(std::chrono::milliseconds interval) {
+    _suppressionReportInterval = static_cast<uint32_t>(std::max<std::chrono::milliseconds::rep>(interval.count(), 1));
+    if (_limiting.load()) _scheduleSuppressionReport();
+  }
+
+  void Logger::setLevel(LogLevel level) {
+    // Can be called while other threads are logging
+    _level.store(level, std::memory_order_relaxed);
+  }
+
+  bool Logger::isEnabled(LogLevel level) {
+    return level >= _level.load(std::memory_order_relaxed);
+  }
+
+  void Logger::debug(std::string_view trace) {
+    if (isEnabled(LogLevel::DEBUG)) _write(LogLevel::DEBUG, trace);
+  }
+
+  void Logger::info(std::string_view trace) {
+    if (isEnabled(LogLevel::INFO)) _write(LogLevel::INFO, trace);
+  }
+
+  void Logger::error(std::string_view trace) {
+    if (isEnabled(LogLevel::ERROR)) _write(LogLevel::ERROR, trace);
+  }
+
+  Logger::RecordStream Logger::getDebugStream() {
+    return isEnabled(LogLevel::DEBUG) ? RecordStream{ LogLevel::DEBUG } : RecordStream{};
+  }
+
+  Logger::RecordStream Logger::getInfoStream() {
+    return isEnabled(LogLevel::INFO) ? RecordStream{ LogLevel::INFO } : RecordStream{};
+  }
+
+  Logger::RecordStream Logger::getErrorStream() {
+    return isEnabled(LogLevel::ERROR) ? RecordStream{ LogLevel::ERROR } : RecordStream{};
+  }
+
+  template <typename FORMAT, typename... ARGS>
+  void Logger::writeFormatted(LogLevel level, FORMAT, std::string_view, const ARGS&... args) {
+    static_assert(_countPlaceholders(FORMAT::text()) == sizeof...(ARGS), "The number of {} placeholders does not match the number of arguments");
+    CallRecord call;
+    auto& record{ *call };
+    TablePin pin;
+    auto& sink{ _levelSink(*pin.table, level) };
+    if constexpr (((_typeCode<ARGS>() != '\0') && ...)) {
+      if ((sink.async.load() && sink.format != Format::JSON) || sink.format == Format::BINARY) {
+        // Deferred formatting: only the descriptor and the raw arguments are copied into the ring (or the binary file)
+        static constexpr char signature[]{ _typeCode<ARGS>()..., '\0' };
+        static constexpr FormatDescriptor descriptor{ FORMAT::text(), std::string_view(signature, sizeof...(ARGS)) };
+        record.reset(level, &descriptor);
+        (_packValue(record.data, args), ...);
+        _commit(sink, record);
+        return;
+      }
+    }
+    record.reset(level);
+    _appendHeader(record.data, record, sink.format);
+    auto message{ record.data.size() };
+    _appendFormatted(record.data, FORMAT::text(), args...);
+    _appendFooter(record.data, message, sink.format);
+    _commit(sink, record);
+  }
+
+  template <typename... FIELDS>
+  void Logger::writeFields(LogLevel level, std::string_view message, const FIELDS&... fields) {
+    static_assert(sizeof...(FIELDS) % 2 == 0, "The fields must be key/value pairs");
+    CallRecord call;
+    auto& record{ *call };
+    TablePin pin;
+    auto& sink{ _levelSink(*pin.table, level) };
+    auto json{ sink.format == Format::JSON };
+    record.reset(level);
+    _appendHeader(record.data, record, sink.format);
+    auto start{ record.data.size() };
+    record.data.append(message);
+    if (json) {
+      _escapeJson(record.data, start);
+      record.data.push_back('"');
+    }
+    else if (_singleLine.load(std::memory_order_relaxed))
+      _escapeLines(record.data, start);
+    _appendFields(record.data, json, fields...);
+    record.data.append(json ? "}\n" : "\n");
+    _commit(sink, record);
+  }
+
+  void Logger::setLogFile(LogLevel level, const std::string& fileName, Policy policy, uint8_t maxNumFiles, uintmax_t maxSize, Format format) {
+    if (level > PROFILING)
+      throw std::runtime_error("Invalid log level");
+
+    _checkNotLogging("setLogFile");
+    std::lock_guard<std::mutex> lock(_configMutex);
+    auto table{ _copyTable() };
+    table->sinks[level] = _openSink(*table, fileName, policy, maxNumFiles, maxSize, format);
+    _publish(std::move(table));
+  }
+
+  void Logger::setLogFile(const std::string& fileName, Policy policy, uint8_t maxNumFiles, uintmax_t maxSize, Format format) {
+    _checkNotLogging("setLogFile");
+    std::lock_guard<std::mutex> lock(_configMutex);
+    auto table{ _copyTable() };
+    auto sink{ _openSink(*table, fileName, policy, maxNumFiles, maxSize, format) };
+    for (auto& levelSink : table->sinks) levelSink = sink;
+    _publish(std::move(table));
+  }
+
+  void Logger::setDateTimeFormat(const std::string& format) {
+    std::lock_guard<std::mutex> lock(_dateTimeFormatMutex);
+    _dateTimeFormat = format;
+    // Invalidates the timestamps cached by the logging threads
+    _dateTimeFormatVersion.fetch_add(1, std::memory_order_release);
+  }
+
+  void Logger::setSingleLine(bool enabled) {
+    _singleLine.store(enabled, std::memory_order_relaxed);
+  }
+
+  void Logger::setFlushPolicy(LogLevel level, Flush policy, uint32_t value) {
+    if (level >= _flushPolicies.size())
+      throw std::runtime_error("Invalid log level for the flush policy");
+
+    _flushPolicies[level].value = value;
+    _flushPolicies[level].policy = policy;
+    if (policy != Flush::INTERVAL) return;
+    _schedule(&_flushPolicies[level], std::chrono::milliseconds(std::max(value, 1u)), [level]() {
+      auto& flushPolicy{ _flushPolicies[level] };
+      if (flushPolicy.policy.load() != Flush::INTERVAL) return std::chrono::milliseconds(0);
+      {
+        TablePin pin;
+        auto& sink{ *pin.table->sinks[level] };
+        std::lock_guard<std::mutex> lock(sink.lsm);
+        sink.flush();
+      }
+      return std::chrono::milliseconds(std::max(flushPolicy.value.load(), 1u));
+    });
+  }
+
+  bool Logger::decodeBinaryLog(std::istream& in, std::ostream& out) {
+    auto readVarint{ [&in](uint64_t& value) {
+      value = 0;
+      for (unsigned shift = 0; shift < 64; shift += 7) {
+        auto byte{ in.get() };
+        if (byte == std::char_traits<char>::eof()) return false;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+      }
+      return false;
+    } };
+    auto readString{ [&in, &readVarint](std::string& text) {
+      uint64_t length;
+      if (!readVarint(length)) return false;
+      // The length comes from the file: the text grows with the bytes read, so a corrupted length fails at the end of the stream
+      text.clear();
+      while (length) {
+        auto chunk{ static_cast<size_t>(std::min<uint64_t>(length, 1 << 16)) };
+        auto size{ text.size() };
+        text.resize(size + chunk);
+        if (!in.read(text.data() + size, static_cast<std::streamsize>(chunk))) return false;
+        length -= chunk;
+      }
+      return true;
+    } };
+
+    std::vector<std::pair<std::string, std::string>> formats;
+    bool segment{ false };
+    uint64_t value, id;
+    int64_t time{ 0 };
+    std::string data, line;
+    const uint16_t endianness{ 1 };
+    for (auto tag{ in.get() }; tag != std::char_traits<char>::eof(); tag = in.get()) {
+      switch (tag) {
+      case 'S': {
+        char header[6];
+        if (!in.read(header, sizeof(header)) || std::string_view(header, 4) != "LOGB" || header[4] != static_cast<char>(_BINARY_VERSION)
+          || header[5] != *reinterpret_cast<const char*>(&endianness) || !readVarint(value))
+          return false;
+        formats.clear();
+        time = static_cast<int64_t>(value);
+        segment = true;
+        break;
+      }
+      case 'F':
+        if (!segment || !readVarint(id) || id != formats.size()) return false;
+        formats.emplace_back();
+        if (!readString(formats.back().first) || !readString(formats.back().second)) return false;
+        break;
+      case 'R': {
+        if (!segment || !readVarint(id) || id >= formats.size()) return false;
+        auto level{ in.get() };
+        if (level < LogLevel::DEBUG || level > LogLevel::ERROR || !readVarint(value) || !readString(data)) return false;
+        time += static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        line.clear();
+        // The threads, sequence numbers and locations of the deferred records are not stored
+        Record header;
+        header.level = static_cast<LogLevel>(level);
+        header.time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(time)));
+        _appendHeader(line, header, Format::TEXT);
+        auto message{ line.size() };
+        if (!_renderDeferred(line, formats[id].first, formats[id].second, data)) return false;
+        _appendFooter(line, message, Format::TEXT);
+        out.write(line.data(), line.size());
+        break;
+      }
+      case 'T':
+        if (!readString(data)) return false;
+        out.write(data.data(), data.size());
+        break;
+      default:
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Logger::setAsync(size_t capacity, Overflow overflow, size_t shards) {
+    _checkNotLogging("setAsync");
+    {
+      std::lock_guard<std::mutex> lock(_configMutex);
+      _asyncCapacity = capacity;
+      _asyncOverflow = overflow;
+      _asyncShards = shards;
+      std::vector<std::pair<std::shared_ptr<LogSink>, std::unique_ptr<AsyncWriter>>> previous;
+      for (auto& sink : _current.table.load()->sinks) {
+        if (std::find_if(previous.begin(), previous.end(), [&sink](auto& entry) { return entry.first == sink; }) == previous.end())
+          previous.emplace_back(sink, sink->replaceAsync(capacity, overflow, shards));
+      }
+      _retireAsync(std::move(previous));
+    }
+    // The pending records of the previous writers are written when it returns
+    _maintenance.waitIdle();
+  }
+
+  void Logger::setCompression(Compression codec, int level) {
+    switch (codec) {
+    case Compression::NONE:
+#ifdef LOGGER_HAS_GZIP
+    case Compression::GZIP:
+#endif
+#ifdef LOGGER_HAS_ZSTD
+    case Compression::ZSTD:
+#endif
+      break;
+    default:
+      throw std::runtime_error("Log compression codec not available in this build");
+    }
+    _compressionLevel = level;
+    _compression = codec;
+  }
+
+  void Logger::setBatching(size_t maxRecords, size_t maxBytes, std::chrono::microseconds maxDelay) {
+    _batchRecords = maxRecords;
+    _batchBytes = maxBytes;
+    _batchDelay = static_cast<uint32_t>(maxDelay.count());
+  }
+
+  bool Logger::setIoUring([[maybe_unused]] bool enable) {
+#ifdef LOGGER_HAS_IO_URING
+    _ioUring = enable && LogFile::ioUringAvailable();
+#else
+    _ioUring = false;
+#endif
+    return _ioUring;
+  }
+
+  void Logger::setMappedFiles(size_t segmentSize) {
+    _mappedSegmentSize = segmentSize;
+  }
+
+  void Logger::flush() {
+    _checkNotLogging("flush");
+    _forEachSink([](LogSink& sink) {
+      if (auto async{ sink.async.load() }) async->waitDrained();
+      std::lock_guard<std::mutex> lock(sink.lsm);
+      sink.flush();
+      if (sink.file) sink.file->fsync();
+    });
+    _forEachOutput([](Sink& sink) { sink.flush(); });
+    _maintenance.waitIdle();
+  }
+
+  void Logger::installCrashHandler() {
+    if (_crashHandlerInstalled.exchange(true)) return;
+    _crashText.reserve(1 << 16);
+    _crashRecord = std::make_unique<Record>();
+#ifdef LOGGER_HAS_SIGACTION
+    _crashUtcOffset = _localTime(std::time(nullptr)).tm_gmtoff;
+    _crashStack.resize(1 << 16);
+    stack_t stack{};
+    stack.ss_sp = _crashStack.data();
+    stack.ss_size = _crashStack.size();
+    sigaltstack(&stack, nullptr);
+    struct sigaction action{};
+    action.sa_handler = &Logger::_onCrashSignal;
+    action.sa_flags = SA_ONSTACK;
+    // A crash signal during the drain kills the process instead of entering the handler again
+    sigemptyset(&action.sa_mask);
+    for (auto signal : _CRASH_SIGNALS) sigaddset(&action.sa_mask, signal);
+    for (size_t i = 0; i < std::size(_CRASH_SIGNALS); ++i) sigaction(_CRASH_SIGNALS[i], &action, &_previousActions[i]);
+#else
+    for (size_t i = 0; i < std::size(_CRASH_SIGNALS); ++i) {
+      auto previous{ std::signal(_CRASH_SIGNALS[i], &Logger::_onCrashSignal) };
+      _previousHandlers[i] = previous == SIG_ERR ? nullptr : previous;
+    }
+#endif
+    _previousTerminate = std::set_terminate(&Logger::_onTerminate);
+  }
+
+  void Logger::addSink(LogLevel level, std::shared_ptr<Sink> sink) {
+    if (level > PROFILING)
+      throw std::runtime_error("Invalid log level for the sink");
+
+    _checkNotLogging("addSink");
+    std::lock_guard<std::mutex> lock(_configMutex);
+    auto table{ _copyTable() };
+    auto& outputs{ table->outputs[level] };
+    if (std::find(outputs.begin(), outputs.end(), sink) == outputs.end()) outputs.push_back(std::move(sink));
+    _publish(std::move(table));
+  }
+
+  void Logger::addSink(std::shared_ptr<Sink> sink) {
+    _checkNotLogging("addSink");
+    std::lock_guard<std::mutex> lock(_configMutex);
+    auto table{ _copyTable() };
+    for (auto& outputs : table->outputs) {
+      if (std::find(outputs.begin(), outputs.end(), sink) == outputs.end()) outputs.push_back(sink);
+    }
+    _publish(std::move(table));
+  }
+
+  void Logger::removeSinks() {
+    _checkNotLogging("removeSinks");
+    // The async writers may be giving them records
+    _forEachSink([](LogSink& sink) { if (auto async{ sink.async.load() }) async->waitDrained(); });
+    std::lock_guard<std::mutex> lock(_configMutex);
+    auto table{ _copyTable() };
+    for (auto& outputs : table->outputs) outputs.clear();
+    _publish(std::move(table));
+  }
+
+  void Logger::rotate() {
+    _forEachSink([](LogSink& sink) {
+      if (sink.fileName == "") return;
+      std::lock_guard<std::mutex> lock(sink.lsm);
+      if (sink.maxNumFiles)
+        _sizeRotation(sink);
+      else {
+        sink.close();
+        sink.open();
+      }
+    });
+    _forEachOutput([](Sink& sink) { sink.rotate(); });
   }
 }
 
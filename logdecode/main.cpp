@@ -0,0 +1,35 @@
+// Converts the binary log files (Logger::Format::BINARY) into the text format of the logger
+//   logdecode <binary log file> [<output file>]
+// The text is written to the standard output if no output file is given
+
+#include "logger.h"
+
+int main(int argc, char* argv[]) {
+  using namespace utils;
+
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " <binary log file> [<output file>]" << std::endl;
+    return 2;
+  }
+
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in.is_open()) {
+    std::cerr << "Log file cannot be opened: " << argv[1] << std::endl;
+    return 1;
+  }
+
+  std::ofstream outFile;
+  if (argc == 3) {
+    outFile.open(argv[2]);
+    if (!outFile.is_open()) {
+      std::cerr << "Output file cannot be opened: " << argv[2] << std::endl;
+      return 1;
+    }
+  }
+
+  if (!Logger::decodeBinaryLog(in, argc == 3 ? outFile : std::cout)) {
+    std::cerr << "Invalid or truncated binary log file: " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
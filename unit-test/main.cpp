@@ -2,11 +2,213 @@
 //#define NO_DEBUG_LOG_BUILD
 
 #define ENABLE_PROFILING_LOG
+#define ENABLE_LOG_IO_URING
 
 #include "logger.h"
 
-int main() {
+#include <regex>
+
+#ifdef LOGGER_HAS_SIGACTION
+ #include <sys/resource.h>
+#endif
+
+namespace {
+  int failures{ 0 };
+
+  void check(bool condition, const char* what) {
+    if (!condition) {
+      std::cerr << "FAILED: " << what << std::endl;
+      ++failures;
+    }
+  }
+
+  std::string readFile(const std::string& fileName) {
+    std::ifstream in(fileName, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  size_t countLines(const std::string& fileName) {
+    auto text{ readFile(fileName) };
+    return static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+  }
+
+  size_t countOf(const std::string& text, const std::string& what) {
+    size_t count{ 0 };
+    for (auto at = text.find(what); at != std::string::npos; at = text.find(what, at + what.size())) ++count;
+    return count;
+  }
+
+  constexpr char before[]{ " [" }, after[]{ "] " }, separator[]{ ": " }, at[]{ " at " };
+
+#ifdef LOGGER_HAS_SIGACTION
+  // Holds the async writer in its first write, so that the next records stay in the ring
+  class BlockingSink : public utils::Logger::Sink {
+  public:
+    std::atomic<bool> entered{ false };
+
+    void write(const utils::Logger::RecordView*, size_t) override {
+      entered = true;
+      while (true) std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+  };
+
+  // Child process of the crash handler test: crashes with records pending in the async ring and in the buffer of the file
+  int crash() {
+    using namespace utils;
+    rlimit noCore{ 0, 0 };
+    setrlimit(RLIMIT_CORE, &noCore);
+    std::filesystem::remove("logfileCrash.log");
+    Logger::setLogFile(LogLevel::INFO, "logfileCrash.log", Logger::Policy::NONE);
+    Logger::setFlushPolicy(LogLevel::INFO, Logger::Flush::NEVER);
+    auto blocking{ std::make_shared<BlockingSink>() };
+    Logger::addSink(LogLevel::INFO, blocking);
+    Logger::setAsync(1024);
+    Logger::installCrashHandler();
+    logInfoF("Crash record {}", 0);
+    while (!blocking->entered) std::this_thread::yield();
+    for (int i = 1; i < 100; ++i) logInfoF("Crash record {}", i);
+    std::raise(SIGSEGV);
+    return 0;
+  }
+#endif
+
+#ifdef LOGGER_HAS_SOCKETS
+  // Local socket of the collector on an ephemeral port of the loopback interface
+  int listenLocal(int type, uint16_t& port) {
+    auto fd{ socket(AF_INET, type, 0) };
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length{ sizeof(address) };
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 || (type == SOCK_STREAM && listen(fd, 1) != 0) ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+    port = ntohs(address.sin_port);
+    return fd;
+  }
+
+  // Data received within 2 seconds
+  std::string receive(int fd) {
+    char data[4096];
+    pollfd descriptor{ fd, POLLIN, 0 };
+    if (poll(&descriptor, 1, 2000) != 1) return "";
+    auto size{ recv(fd, data, sizeof(data), 0) };
+    return size > 0 ? std::string(data, static_cast<size_t>(size)) : "";
+  }
+#endif
+
+  // Logs a stream record of another level from within the fan-out of a record
+  class StreamLoggingSink : public utils::Logger::Sink {
+  public:
+    void write(const utils::Logger::RecordView*, size_t) override {
+      debugOut << "Stream record of a sink " << 1;
+    }
+  };
+
+  struct Throwing {};
+
+  std::ostream& operator<<(std::ostream& out, const Throwing&) {
+    throw std::runtime_error("operand failed");
+    return out;
+  }
+
+  // Logs a record of its own level for each batch: the record is not given back to it
+  class SelfLoggingSink : public utils::Logger::Sink {
+  public:
+    size_t records{ 0 };
+
+    void write(const utils::Logger::RecordView*, size_t count) override {
+      records += count;
+      logInfo("Record of a sink about itself");
+    }
+  };
+
+  // Logs a formatted record of another level from within the fan-out of a record
+  class FormattedLoggingSink : public utils::Logger::Sink {
+  public:
+    void write(const utils::Logger::RecordView*, size_t) override {
+      logDebugF("Formatted record of a sink {} {}", std::string(200, 's'), 2);
+    }
+  };
+
+  // Logs a record while it is formatted as an argument
+  struct LoggingArgument {};
+
+  std::ostream& operator<<(std::ostream& out, const LoggingArgument&) {
+    logDebugF("Record of an argument {}", std::string(200, 'a'));
+    return out << "argument";
+  }
+
+  // Tries to configure the logger from write()
+  class ConfiguringSink : public utils::Logger::Sink {
+  public:
+    size_t rejected{ 0 };
+
+    void write(const utils::Logger::RecordView*, size_t) override {
+      try {
+        utils::Logger::setAsync(16);
+      }
+      catch (const std::runtime_error&) {
+        ++rejected;
+      }
+    }
+  };
+
+  // Tries to configure the logger while it is formatted as an argument
+  struct ConfiguringArgument {};
+
+  std::ostream& operator<<(std::ostream& out, const ConfiguringArgument&) {
+    try {
+      utils::Logger::setLogFile("logfileConfigured.log", utils::Logger::Policy::NONE);
+    }
+    catch (const std::runtime_error&) {
+      return out << "rejected";
+    }
+    return out << "accepted";
+  }
+
+  // Logs from its destructor, once the statistics of its thread have been merged into the ones of the finished threads
+  struct ExitLogger {
+    int records{ 0 };
+
+    ~ExitLogger() {
+      for (int i = 0; i < records; ++i) infoOut << "Record of an exiting thread " << i;
+    }
+  };
+
+  // Constructs the ExitLogger of the thread while a stream record is formatted: after the buffer of the stream, which it uses, and
+  // before the statistics of the thread
+  struct ExitLoggerStart {
+    int records;
+  };
+
+  std::ostream& operator<<(std::ostream& out, const ExitLoggerStart& start) {
+    thread_local ExitLogger exitLogger;
+    exitLogger.records = start.records;
+    return out << "started";
+  }
+
+  // Writes slowly: the producers of a small async ring block on it
+  class SlowSink : public utils::Logger::Sink {
+  public:
+    size_t records{ 0 };
+
+    void write(const utils::Logger::RecordView*, size_t count) override {
+      records += count;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+}
+
+int main(int argc, char* argv[]) {
   using namespace utils;
+  namespace fs = std::filesystem;
+
+#ifdef LOGGER_HAS_SIGACTION
+  if (argc == 2 && std::string(argv[1]) == "--crash") return crash();
+#endif
 
   timerStart;
 
@@ -16,6 +218,7 @@ int main() {
   logInfo("(INFO)");
   logDebug("Debug");
   debugOut << 2 << "dfsadf";
+  logInfoF("Formatted {} {} {{{}}}", 2, "args", 1.5);
 
   Logger::setLevel(LogLevel::INFO);
   infoOut << "INFO set";
@@ -45,11 +248,513 @@ int main() {
   Logger::setLogFile(LogLevel::ERROR, "logfile.log", Logger::Policy::MAX_SIZE);
 
   for (int i = 0; i < 10; ++i) {
+    timerScope("log file loop");
     logError("Log file Error info");
     infoOut << "Log file test " << i;
     logInfo("Log file (INFO)");
     logDebug("Log file Debug");
     debugOut << "Log file" << i << "dfsadf";
   }
-   
+
+  Logger::dumpTimerStats();
+
+  // Key/value records, in a JSON file and in a text file
+  fs::remove("logfile.json");
+  Logger::setLogFile(LogLevel::INFO, "logfile.json", Logger::Policy::NONE, 0, 0, Logger::Format::JSON);
+  logInfoKV("JSON record", "user", 42, "path", "/a \"b\"");
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+  logInfoKV("Text record", "user", 42, "path", "/a \"b\"");
+  Logger::flush();
+  {
+    auto json{ readFile("logfile.json") };
+    check(json.find("\"level\":\"INFO\",\"message\":\"JSON record\",\"user\":42,\"path\":\"/a \\\"b\\\"\"}\n") != std::string::npos, "JSON record");
+    check(readFile("logfile.log").find("Text record user=42 path=\"/a \\\"b\\\"\"\n") != std::string::npos, "key/value text record");
+  }
+
+  // Async mode switched on and off while other threads are logging: no record is lost
+  fs::remove("logfileAsync.log");
+  Logger::setLogFile(LogLevel::INFO, "logfileAsync.log", Logger::Policy::NONE);
+  {
+    const int RECORDS{ 3000 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; ++t) {
+      threads.emplace_back([t, RECORDS]() {
+        for (int i = 0; i < RECORDS; ++i) {
+          if (i % 3 == 0)
+            logInfoF("Async thread {} record {}", t, i);
+          else if (i % 3 == 1)
+            logInfo("Async record");
+          else
+            infoOut << "Async stream " << i;
+        }
+      });
+    }
+    for (size_t i = 0; i < 20; ++i) {
+      Logger::setAsync(i % 4 == 3 ? 0 : 256, Logger::Overflow::BLOCK);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (auto& thread : threads) thread.join();
+    Logger::setAsync(0);
+    Logger::flush();
+    check(countLines("logfileAsync.log") == 3 * RECORDS, "async toggled under load");
+  }
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // Sharded rings: every record is written, and the records of each thread stay in order
+  fs::remove("logfileSharded.log");
+  Logger::setLogFile(LogLevel::INFO, "logfileSharded.log", Logger::Policy::NONE);
+  {
+    const int THREADS{ 4 }, RECORDS{ 2000 };
+    Logger::setAsync(1024, Logger::Overflow::BLOCK, THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+      threads.emplace_back([t, RECORDS]() {
+        for (int i = 0; i < RECORDS; ++i) logInfoF("Shard thread {} record {}", t, i);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    Logger::setAsync(0);
+    Logger::flush();
+    std::ifstream in("logfileSharded.log");
+    std::vector<int> next(THREADS, 0);
+    bool ordered{ true };
+    for (std::string line; std::getline(in, line);) {
+      int t, i;
+      auto text{ line.find("Shard thread ") };
+      if (text == std::string::npos || std::sscanf(line.c_str() + text, "Shard thread %d record %d", &t, &i) != 2 || t < 0 || t >= THREADS) continue;
+      ordered &= i == next[t]++;
+    }
+    check(ordered && std::all_of(next.begin(), next.end(), [RECORDS](int count) { return count == RECORDS; }), "sharded records in order per thread");
+  }
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // BINARY file decoded back into text, as done by logdecode
+  fs::remove("logfile.logb");
+  Logger::setLogFile(LogLevel::INFO, "logfile.logb", Logger::Policy::NONE, 0, 0, Logger::Format::BINARY);
+  for (int i = 0; i < 100; ++i) logInfoF("Binary record {} of {} ({})", i, "unit-test", 0.5 * i);
+  logInfo("Binary text record");
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+  Logger::flush();
+  {
+    std::ifstream in("logfile.logb", std::ios::binary);
+    std::stringstream decoded;
+    check(Logger::decodeBinaryLog(in, decoded), "binary file decoded");
+    std::string line;
+    int records{ 0 };
+    bool text{ false };
+    while (std::getline(decoded, line)) {
+      auto expected{ "INFO: Binary record " + std::to_string(records) + " of unit-test (" + std::to_string(records / 2) + (records % 2 ? ".5)" : ")") };
+      if (line.find(expected) != std::string::npos) ++records;
+      text |= line.find("INFO: Binary text record") != std::string::npos;
+    }
+    check(records == 100 && text, "binary records decoded in order");
+    auto binary{ readFile("logfile.logb") };
+    std::istringstream truncated(binary.substr(0, binary.size() - 3));
+    check(!Logger::decodeBinaryLog(truncated, decoded), "truncated binary file detected");
+    // Segment header (with a time base of 0) followed by a text of 2^63 - 1 bytes
+    std::istringstream corrupted(binary.substr(0, 7) + '\0' + "T\xff\xff\xff\xff\xff\xff\xff\xff\x7f" + "short text");
+    check(!Logger::decodeBinaryLog(corrupted, decoded), "corrupted length in a binary file detected");
+  }
+
+#ifdef LOGGER_HAS_MMAP
+  // Memory mapped file growing over several segments from several threads, truncated to its data when closed
+  fs::remove("logfileMapped.log");
+  Logger::setMappedFiles(4096);
+  Logger::setLogFile(LogLevel::INFO, "logfileMapped.log", Logger::Policy::NONE);
+  Logger::setMappedFiles(0);
+  {
+    const int THREADS{ 4 }, RECORDS{ 500 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+      threads.emplace_back([t, RECORDS]() {
+        for (int i = 0; i < RECORDS; ++i) logInfoF("Mapped thread {} record {}", t, i);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+    Logger::flush();
+    auto text{ readFile("logfileMapped.log") };
+    check(countLines("logfileMapped.log") == THREADS * RECORDS && text.find('\0') == std::string::npos && text.back() == '\n', "mapped file");
+  }
+#endif
+
+  // Rate limits per level and per call site, sampling, and the reports of the suppressed records
+  fs::remove("logfileLimited.log");
+  Logger::setLogFile(LogLevel::DEBUG, "logfileLimited.log", Logger::Policy::NONE);
+  Logger::setLogFile(LogLevel::INFO, "logfileLimited.log", Logger::Policy::NONE);
+  {
+    Logger::setSuppressionReportInterval(std::chrono::milliseconds(20));
+    auto suppressed{ Logger::stats().suppressed[LogLevel::INFO] };
+    Logger::setRateLimit(LogLevel::INFO, 10, 10);
+    for (int i = 0; i < 100; ++i) logInfoF("Rate limited {}", i);
+    Logger::setRateLimit(LogLevel::INFO, 0);
+    check(Logger::stats().suppressed[LogLevel::INFO] - suppressed >= 85, "records over the rate limit counted");
+    Logger::setSampling(LogLevel::DEBUG, 10);
+    for (int i = 0; i < 100; ++i) logDebugF("Sampled {}", i);
+    Logger::setSampling(LogLevel::DEBUG, 0);
+    Logger::setCallSiteRateLimit(5, 5);
+    for (int i = 0; i < 100; ++i) logInfo("Call site limited");
+    logInfo("Other call site");
+    bool reported{ false };
+    for (int i = 0; i < 100 && !reported; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      Logger::flush();
+      reported = readFile("logfileLimited.log").find(" records at ") != std::string::npos;
+    }
+    Logger::setCallSiteRateLimit(0);
+    Logger::setSuppressionReportInterval(std::chrono::seconds(10));
+    auto text{ readFile("logfileLimited.log") };
+    auto limited{ countOf(text, "Rate limited ") }, limitedSite{ countOf(text, "Call site limited") };
+    check(limited >= 10 && limited <= 12, "rate limit per level");
+    check(countOf(text, "Sampled ") == 10, "sampling");
+    check(limitedSite >= 5 && limitedSite <= 6 && countOf(text, "Other call site") == 1, "rate limit per call site");
+    check(reported && text.find("Suppressed ") != std::string::npos, "suppressed records reported");
+  }
+  Logger::setLogFile(LogLevel::DEBUG, "logfileDEB.log", Logger::Policy::DAILY);
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // A DAILY file left from a previous day is rotated at the next tick, and named after the day it was written
+  {
+    fs::create_directories("stale");
+    for (auto& entry : fs::directory_iterator("stale")) fs::remove(entry.path());
+    { std::ofstream("stale/logfileDaily.log") << "Record of a previous day\n"; }
+    auto written{ std::chrono::system_clock::now() - std::chrono::hours(48) };
+    fs::last_write_time("stale/logfileDaily.log", fs::file_time_type::clock::now() - std::chrono::hours(48));
+    auto time{ std::chrono::system_clock::to_time_t(written) };
+    char day[16];
+    std::strftime(day, sizeof(day), "%Y%m%d", std::localtime(&time));
+    auto rotated{ std::string("stale/logfileDaily.log.") + day };
+    Logger::setLogFile(LogLevel::DEBUG, "stale/logfileDaily.log", Logger::Policy::DAILY);
+    for (int i = 0; i < 100 && !fs::exists(rotated); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      Logger::flush();
+    }
+    logDebug("Record of today");
+    Logger::flush();
+    check(readFile(rotated) == "Record of a previous day\n", "stale DAILY file rotated");
+    check(readFile("stale/logfileDaily.log").find("Record of a previous day") == std::string::npos &&
+      readFile("stale/logfileDaily.log").find("Record of today") != std::string::npos, "records of today in a new DAILY file");
+    Logger::setLogFile(LogLevel::DEBUG, "logfileDEB.log", Logger::Policy::DAILY);
+  }
+
+  // Layouts of the header: time in microseconds, thread, level and location of the statement, then the default layout again
+  fs::remove("logfileLayout.log");
+  Logger::setLogFile(LogLevel::INFO, "logfileLayout.log", Logger::Policy::NONE);
+  {
+    Logger::setLayout<Logger::Layout<Logger::Time<std::chrono::microseconds>, Logger::Lit<before>, Logger::ThreadId, Logger::Lit<after>, Logger::Level,
+      Logger::Lit<at>, Logger::Location, Logger::Lit<separator>, Logger::Msg>>();
+    logInfo("Layout record");
+    std::thread([]() { logInfo("Layout record of another thread"); }).join();
+    Logger::setLayout<Logger::DefaultLayout>();
+    logInfo("Default layout record");
+    Logger::flush();
+    std::ifstream in("logfileLayout.log");
+    std::string line1, line2, line3;
+    std::getline(in, line1);
+    std::getline(in, line2);
+    std::getline(in, line3);
+    std::smatch first, second;
+    std::regex layout{ R"(^\d{4}-\d{2}-\d{2} \d{2}:\d{2}:\d{2}\.\d{6} \[(\d+)\] INFO at main\.cpp:\d+: (Layout record.*)$)" };
+    check(std::regex_match(line1, first, layout) && first[2] == "Layout record", "layout record");
+    check(std::regex_match(line2, second, layout) && second[2] == "Layout record of another thread" && second[1] != first[1], "thread of the layout record");
+    check(std::regex_match(line3, std::regex{ R"(^\d{4}-\d{2}-\d{2} \d{2}:\d{2}:\d{2}\.\d{3} - INFO: Default layout record$)" }), "default layout restored");
+  }
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // Flight recorder: the last DEBUG records of the thread are written just before its next ERROR record, and by dumpRecent()
+  fs::remove("logfileRecorder.log");
+  Logger::setLogFile(LogLevel::ERROR, "logfileRecorder.log", Logger::Policy::NONE);
+  {
+    Logger::setFlightRecorder(16);
+    for (int i = 0; i < 32; ++i) logDebugF("Recorded {}", i);
+    logError("Error after the recorded records");
+    logDebug("Recorded again");
+    Logger::dumpRecent();
+    Logger::setFlightRecorder(0);
+    Logger::flush();
+    std::ifstream in("logfileRecorder.log");
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) {
+      if (line.find("Recorded") != std::string::npos || line.find("Error after") != std::string::npos) lines.push_back(line);
+    }
+    bool ordered{ lines.size() == 18 };
+    for (size_t i = 0; ordered && i < 16; ++i) ordered = lines[i].find("DEBUG: Recorded " + std::to_string(16 + i)) != std::string::npos;
+    check(ordered, "recorded DEBUG records before the ERROR record");
+    check(lines.size() == 18 && lines[16].find("Error after the recorded records") != std::string::npos &&
+      lines[17].find("DEBUG: Recorded again") != std::string::npos, "recorded DEBUG records dumped");
+  }
+  Logger::setLogFile(LogLevel::ERROR, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+#ifdef LOGGER_HAS_SIGACTION
+  // Crash handler, in a child process: the records pending in the async ring and in the buffer of the file are written before it dies
+  {
+    auto status{ std::system(("\"" + std::string(argv[0]) + "\" --crash").c_str()) };
+    auto text{ readFile("logfileCrash.log") };
+    bool written{ true };
+    for (int i = 0; i < 100; ++i) written &= text.find("INFO: Crash record " + std::to_string(i) + "\n") != std::string::npos;
+    check(status != 0 && written && text.find("*** CRASH (SIGSEGV): 99 pending records written by the crash handler\n") != std::string::npos, "crash handler");
+  }
+#endif
+
+#ifdef LOGGER_HAS_SOCKETS
+  // Network sinks: RFC 5424 messages sent to a local collector, in a datagram over UDP and with octet counting over TCP
+  {
+    std::regex syslog{ R"(^<11>1 \d{4}-\d{2}-\d{2}T\d{2}:\d{2}:\d{2}\.\d{6}Z \S+ unit-test \d+ - - Network record over (UDP|TCP)$)" };
+    uint16_t port{ 0 };
+    auto udp{ listenLocal(SOCK_DGRAM, port) };
+    check(udp >= 0, "UDP collector");
+    auto udpSink{ std::make_shared<Logger::NetworkSink>(Logger::NetworkSink::Protocol::UDP, "127.0.0.1", port, "unit-test") };
+    Logger::addSink(LogLevel::ERROR, udpSink);
+    logError("Network record over UDP");
+    Logger::flush();
+    check(std::regex_match(receive(udp), syslog), "syslog message over UDP");
+    Logger::removeSinks();
+    close(udp);
+
+    auto listener{ listenLocal(SOCK_STREAM, port) };
+    check(listener >= 0, "TCP collector");
+    auto tcpSink{ std::make_shared<Logger::NetworkSink>(Logger::NetworkSink::Protocol::TCP, "127.0.0.1", port, "unit-test") };
+    Logger::addSink(LogLevel::ERROR, tcpSink);
+    logError("Network record over TCP");
+    pollfd descriptor{ listener, POLLIN, 0 };
+    auto tcp{ poll(&descriptor, 1, 2000) == 1 ? accept(listener, nullptr, nullptr) : -1 };
+    std::string frame;
+    for (int i = 0; i < 10 && tcp >= 0 && frame.find(" TCP") == std::string::npos; ++i) frame += receive(tcp);
+    auto space{ frame.find(' ') };
+    check(space != std::string::npos && frame.substr(0, space) == std::to_string(frame.size() - space - 1) && std::regex_match(frame.substr(space + 1), syslog),
+      "syslog message over TCP");
+    Logger::removeSinks();
+    if (tcp >= 0) close(tcp);
+    close(listener);
+  }
+#endif
+
+  // Stream records: one logged by a sink while another one is being committed, and one whose operand throws
+  fs::remove("logfileStream.log");
+  Logger::setLogFile(LogLevel::INFO, "logfileStream.log", Logger::Policy::NONE);
+  {
+    std::ostringstream copy;
+    Logger::addSink(LogLevel::INFO, std::make_shared<StreamLoggingSink>());
+    Logger::addSink(LogLevel::INFO, std::make_shared<Logger::StreamSink>(copy));
+    infoOut << "Stream record " << 2;
+    Logger::removeSinks();
+    check(copy.str().find("INFO: Stream record 2\n") != std::string::npos, "stream record committed while a sink logs a stream record");
+    try {
+      infoOut << "Partial stream record " << Throwing{};
+    }
+    catch (const std::runtime_error&) {}
+    infoOut << "Stream record after the exception";
+    Logger::flush();
+    auto text{ readFile("logfileStream.log") };
+    check(text.find("Partial stream record") == std::string::npos && text.find("INFO: Stream record after the exception\n") != std::string::npos,
+      "partial stream record not committed");
+  }
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // Size rotation of a file removed by another process: the rotation fails, and the file is created again
+  for (size_t segmentSize : { size_t(0), size_t(4096) }) {
+    fs::remove("logfileRemoved.log");
+    Logger::setMappedFiles(segmentSize);
+    Logger::setLogFile(LogLevel::INFO, "logfileRemoved.log", Logger::Policy::MAX_SIZE, 3, 300);
+    Logger::setMappedFiles(0);
+    logInfo("Before the removal");
+    Logger::flush();
+    fs::remove("logfileRemoved.log");
+    for (int i = 0; i < 10; ++i) logInfoF("After the removal {}", i);
+    Logger::flush();
+    check(readFile("logfileRemoved.log").find("INFO: After the removal 9") != std::string::npos, "rotation of a removed file");
+    // Closed before the next file is opened with the same name
+    Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+    Logger::flush();
+  }
+
+  // Archives of another extension, left before the compression was changed, are not kept beyond the number of files
+  {
+    for (auto file : { "logfileRetention.log", "logfileRetention.log.1", "logfileRetention.log.1.gz", "logfileRetention.log.2.gz", "logfileRetention.log.3" })
+      fs::remove(file);
+    for (auto file : { "logfileRetention.log.1", "logfileRetention.log.1.gz", "logfileRetention.log.2.gz" })
+      std::ofstream(file) << "Archive " << file << '\n';
+    Logger::setLogFile(LogLevel::INFO, "logfileRetention.log", Logger::Policy::MAX_SIZE, 3, 500);
+    logInfo("Record of the rotated file");
+    Logger::rotate();
+    Logger::flush();
+    size_t archives{ 0 };
+    for (auto file : { "logfileRetention.log.1", "logfileRetention.log.1.gz", "logfileRetention.log.2", "logfileRetention.log.2.gz", "logfileRetention.log.3" })
+      archives += fs::exists(file);
+    check(archives == 2 && readFile("logfileRetention.log.1").find("INFO: Record of the rotated file") != std::string::npos, "archives of both extensions");
+  }
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // Sinks logging from write(): a record of another level is fanned out while the outer record is, and a record of its own level
+  // goes to the file and to the other sinks only
+  fs::remove("logfileSinks.log");
+  Logger::setLogFile("logfileSinks.log", Logger::Policy::NONE);
+  {
+    std::ostringstream infoCopy, debugCopy;
+    Logger::addSink(LogLevel::INFO, std::make_shared<StreamLoggingSink>());
+    Logger::addSink(LogLevel::DEBUG, std::make_shared<Logger::StreamSink>(debugCopy));
+    Logger::addSink(LogLevel::INFO, std::make_shared<Logger::StreamSink>(infoCopy));
+    logInfo("Record given to the sinks");
+    Logger::removeSinks();
+    check(infoCopy.str().find("INFO: Record given to the sinks\n") != std::string::npos && countOf(infoCopy.str(), "\n") == 1
+      && countOf(debugCopy.str(), "DEBUG: Stream record of a sink 1\n") == 1, "nested fan-out");
+
+    auto self{ std::make_shared<SelfLoggingSink>() };
+    std::ostringstream otherCopy;
+    Logger::addSink(LogLevel::INFO, self);
+    Logger::addSink(LogLevel::INFO, std::make_shared<Logger::StreamSink>(otherCopy));
+    logInfo("Record given to a self logging sink");
+    Logger::removeSinks();
+    Logger::flush();
+    check(self->records == 1 && countOf(otherCopy.str(), "INFO: Record of a sink about itself\n") == 1
+      && countOf(readFile("logfileSinks.log"), "INFO: Record of a sink about itself\n") == 1, "sink logging about itself");
+  }
+  Logger::setLogFile(LogLevel::DEBUG, "logfileDEB.log", Logger::Policy::DAILY);
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+  Logger::setLogFile(LogLevel::ERROR, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // Logging calls nested in a logging call: by the formatting of an argument and by a sink
+  fs::remove("logfileNested.log");
+  Logger::setLogFile("logfileNested.log", Logger::Policy::NONE);
+  {
+    std::ostringstream copy;
+    logInfoF("Record with an {} {}", LoggingArgument{}, 1);
+    Logger::addSink(LogLevel::INFO, std::make_shared<FormattedLoggingSink>());
+    Logger::addSink(LogLevel::INFO, std::make_shared<Logger::StreamSink>(copy));
+    logInfoF("Record given to a {} {}", "sink", 2);
+    Logger::removeSinks();
+    Logger::flush();
+    auto text{ readFile("logfileNested.log") };
+    check(countOf(text, "INFO: Record with an argument 1\n") == 1 && countOf(text, "DEBUG: Record of an argument " + std::string(200, 'a') + "\n") == 1
+      && countOf(text, "INFO: Record given to a sink 2\n") == 1 && countOf(text, "DEBUG: Formatted record of a sink " + std::string(200, 's') + " 2\n") == 1
+      && copy.str().find("INFO: Record given to a sink 2\n") != std::string::npos, "nested logging calls");
+  }
+  Logger::setLogFile(LogLevel::DEBUG, "logfileDEB.log", Logger::Policy::DAILY);
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+  Logger::setLogFile(LogLevel::ERROR, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // Configuration calls made while logging fail instead of waiting for themselves
+  {
+    auto sink{ std::make_shared<ConfiguringSink>() };
+    Logger::addSink(LogLevel::INFO, sink);
+    logInfo("Record given to a configuring sink");
+    Logger::removeSinks();
+    logInfoF("Configuration {}", ConfiguringArgument{});
+    Logger::flush();
+    check(sink->rejected == 1 && readFile("logfile.log").find("INFO: Configuration rejected\n") != std::string::npos && !fs::exists("logfileConfigured.log"),
+      "configuration while logging");
+  }
+
+  // A file is shared with the settings it was opened with, also while it is being closed after it was replaced
+  fs::remove("logfileShared.log");
+  Logger::setLogFile(LogLevel::DEBUG, "logfileShared.log", Logger::Policy::MAX_SIZE, 3, 100000);
+  {
+    // Other settings are ignored: the file does not rotate at 10 bytes
+    Logger::setLogFile(LogLevel::INFO, "logfileShared.log", Logger::Policy::MAX_SIZE, 4, 10);
+    logInfo("Record of a shared file");
+    logInfo("Record of a shared file");
+    Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+    Logger::flush();
+    check(countOf(readFile("logfileShared.log"), "INFO: Record of a shared file\n") == 2 && !fs::exists("logfileShared.log.1"), "file shared with other settings");
+    // Two mapped sinks of a file would write over each other
+    Logger::setMappedFiles(4096);
+    Logger::setAsync(64);
+    for (int i = 0; i < 100; ++i) {
+      if (i % 2)
+        Logger::setLogFile(LogLevel::DEBUG, "logfileShared.log", Logger::Policy::MAX_SIZE, 3, 100000);
+      else
+        Logger::setLogFile(LogLevel::DEBUG, "logfileDEB.log", Logger::Policy::DAILY);
+      logDebugF("Shared record {}", i);
+    }
+    Logger::setAsync(0);
+    Logger::setMappedFiles(0);
+    // Closed, so that a mapped file is truncated to its data
+    Logger::setLogFile(LogLevel::DEBUG, "logfileDEB.log", Logger::Policy::DAILY);
+    Logger::flush();
+    auto text{ readFile("logfileShared.log") };
+    size_t found{ 0 };
+    for (int i = 1; i < 100; i += 2) found += countOf(text, "DEBUG: Shared record " + std::to_string(i) + "\n");
+    check(found == 50 && text.find('\0') == std::string::npos, "file reopened while it is being closed");
+  }
+
+  // io_uring: the records go through the registered buffers in order, also a record larger than a buffer, after the existing content
+  if (Logger::setIoUring(true)) {
+    fs::remove("logfileUring.log");
+    std::ofstream("logfileUring.log") << "Existing content\n";
+    Logger::setLogFile(LogLevel::INFO, "logfileUring.log", Logger::Policy::NONE);
+    Logger::setIoUring(false);
+    const int RECORDS{ 40000 };
+    std::string large(600000, 'u');
+    for (int i = 0; i < RECORDS; ++i) {
+      logInfoF("Uring record {}", i);
+      if (i == RECORDS / 2) logInfo(large);
+    }
+    Logger::flush();
+    Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+    Logger::flush();
+    std::ifstream in("logfileUring.log");
+    std::string line;
+    std::getline(in, line);
+    bool ordered{ line == "Existing content" };
+    for (int i = 0; ordered && i < RECORDS; ++i) {
+      ordered = std::getline(in, line) && line.find("INFO: Uring record " + std::to_string(i)) != std::string::npos && line.size() < 100;
+      if (ordered && i == RECORDS / 2) ordered = std::getline(in, line) && line.find("INFO: " + large) != std::string::npos;
+    }
+    check(ordered && !std::getline(in, line), "records written through io_uring");
+  }
+  else
+    std::cerr << "io_uring not available: not tested" << std::endl;
+
+  // Threads logging while they exit share the statistics of the finished threads: no count is lost
+  fs::remove("logfileExit.log");
+  Logger::setLogFile(LogLevel::INFO, "logfileExit.log", Logger::Policy::NONE);
+  {
+    const int THREADS{ 8 }, RECORDS{ 20000 };
+    auto before{ Logger::stats() };
+    std::atomic<int> started{ 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+      threads.emplace_back([&started]() {
+        infoOut << "Exit logger " << ExitLoggerStart{ RECORDS };
+        // The threads exit together
+        ++started;
+        while (started.load() < THREADS) std::this_thread::yield();
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    auto after{ Logger::stats() };
+    // The latency is counted out of the lock of the file
+    check(after.records[LogLevel::INFO] - before.records[LogLevel::INFO] >= THREADS * (RECORDS + 1)
+      && after.writes - before.writes >= THREADS * (RECORDS + 1), "records counted while the threads exit");
+  }
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  // Producers blocked on a full ring wait for the writer instead of spinning
+  fs::remove("logfileBlocked.log");
+  Logger::setLogFile(LogLevel::INFO, "logfileBlocked.log", Logger::Policy::NONE);
+  {
+    const int THREADS{ 4 }, RECORDS{ 100 };
+    auto sink{ std::make_shared<SlowSink>() };
+    Logger::addSink(LogLevel::INFO, sink);
+    Logger::setAsync(4, Logger::Overflow::BLOCK);
+    auto cpuStart{ std::clock() };
+    auto start{ std::chrono::steady_clock::now() };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+      threads.emplace_back([]() {
+        for (int i = 0; i < RECORDS; ++i) logInfoF("Blocked record {}", i);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    Logger::setAsync(0);
+    auto cpu{ static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC };
+    auto elapsed{ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+    Logger::removeSinks();
+    Logger::flush();
+    check(countLines("logfileBlocked.log") == THREADS * RECORDS && sink->records == THREADS * RECORDS && cpu < elapsed / 2, "producers waiting for a full ring");
+  }
+  Logger::setLogFile(LogLevel::INFO, "logfile.log", Logger::Policy::MAX_SIZE, 4, 500);
+
+  Logger::flush();
+  return failures ? 1 : 0;
 }
\ No newline at end of file